@@ -0,0 +1,119 @@
+#ifndef DWL_RVIZ_PLUGIN__COLORMAP__H
+#define DWL_RVIZ_PLUGIN__COLORMAP__H
+
+#include <OGRE/OgreColourValue.h>
+#include <vector>
+
+
+namespace dwl_rviz_plugin
+{
+
+/** @brief Colormaps of the cost values */
+enum ColormapType {FULL_COLOR, GREY, VIRIDIS, MAGMA, INFERNO, PLASMA};
+
+/**
+ * @class Colormap
+ * @brief Lookup table of a colormap from a minimum to a maximum value
+ * The colors are precomputed, so mapping a value is a normalization and a
+ * lookup, and all the colormaps have the same cost. The values of a batch are
+ * normalized by a branchless loop that is vectorized by the compiler.
+ */
+class Colormap
+{
+	public:
+		/** @brief Constructor function */
+		Colormap();
+
+		/** @brief Destructor function */
+		~Colormap();
+
+		/**
+		 * @brief Sets the type of colormap, and computes its table
+		 * @param ColormapType Type of colormap
+		 */
+		void setType(ColormapType type);
+
+		/** @brief Gets the type of colormap */
+		ColormapType getType() const;
+
+		/**
+		 * @brief Sets the range of the values, where the values out of the range
+		 * are clamped
+		 * @param float Minimum value
+		 * @param float Maximum value
+		 */
+		void setRange(float min_value, float max_value);
+
+		/**
+		 * @brief Gets the color of a value
+		 * @param float Value
+		 * @return Color of the value
+		 */
+		const Ogre::ColourValue& getColor(float value) const;
+
+		/**
+		 * @brief Maps a set of values to colors, which can be members of a set
+		 * of structures, e.g. the color of a set of points
+		 * @param Ogre::ColourValue* First color
+		 * @param size_t Stride between the colors, in bytes
+		 * @param const float* Set of values
+		 * @param unsigned int Number of values
+		 */
+		void getColors(Ogre::ColourValue* colors,
+					   size_t stride,
+					   const float* values,
+					   unsigned int num_values) const;
+
+		/**
+		 * @brief Maps a set of values to packed colors
+		 * @param Ogre::RGBA* Packed colors, as Ogre::ColourValue::getAsRGBA()
+		 * @param const float* Set of values
+		 * @param unsigned int Number of values
+		 */
+		void getColors(Ogre::RGBA* colors,
+					   const float* values,
+					   unsigned int num_values) const;
+
+		/** @brief Gets the packed colors of the table, from the minimum to the
+		 * maximum value */
+		const std::vector<Ogre::RGBA>& getTable() const;
+
+		/** @brief Number of colors of the table */
+		static const unsigned int size = 256;
+
+
+	private:
+		/**
+		 * @brief Computes the table indexes of a set of values
+		 * @param unsigned int* Table indexes
+		 * @param const float* Set of values
+		 * @param unsigned int Number of values
+		 */
+		void getIndexes(unsigned int* indexes,
+						const float* values,
+						unsigned int num_values) const;
+
+		/**
+		 * @brief Computes the color of a normalized value
+		 * @param ColormapType Type of colormap
+		 * @param float Normalized value in [0,1]
+		 * @return Color of the value
+		 */
+		static Ogre::ColourValue computeColor(ColormapType type,
+											  float value);
+
+		/** @brief Type of colormap */
+		ColormapType type_;
+
+		/** @brief Colors and packed colors of the table */
+		std::vector<Ogre::ColourValue> colors_;
+		std::vector<Ogre::RGBA> packed_colors_;
+
+		/** @brief Minimum value and scale from a value to a table index */
+		float min_value_;
+		float scale_;
+};
+
+} //@namespace dwl_rviz_plugin
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef DWL_RVIZ_PLUGIN__KD_TREE__H
+#define DWL_RVIZ_PLUGIN__KD_TREE__H
+
+#include <Eigen/Dense>
+#include <vector>
+
+
+namespace dwl_rviz_plugin
+{
+
+/**
+ * @class KdTree
+ * @brief Static 3d tree for nearest point queries
+ * The tree is balanced and stored implicitly in a permutation of the points,
+ * i.e. the node of a range is its median and its children are the two
+ * halves. So building it is O(n log n) and a query is O(log n) on average.
+ */
+class KdTree
+{
+	public:
+		/** @brief Constructor function */
+		KdTree();
+
+		/** @brief Destructor function */
+		~KdTree();
+
+		/**
+		 * @brief Builds the tree from a set of points
+		 * The id of a point is its index in the set.
+		 * @param const std::vector<Eigen::Vector3f>& Set of points
+		 */
+		void build(const std::vector<Eigen::Vector3f>& points);
+
+		/** @brief Removes all the points */
+		void clear();
+
+		/**
+		 * @brief Finds the nearest point to a query
+		 * @param unsigned int& Id of the nearest point
+		 * @param float& Squared distance to the nearest point
+		 * @param const Eigen::Vector3f& Query point
+		 * @return False if the tree is empty
+		 */
+		bool nearest(unsigned int& id,
+					 float& sq_distance,
+					 const Eigen::Vector3f& query) const;
+
+		/** @brief Gets the number of points */
+		unsigned int size() const;
+
+
+	private:
+		/**
+		 * @brief Builds recursively the nodes of a range
+		 * @param unsigned int First index of the range
+		 * @param unsigned int Last index (not included) of the range
+		 * @param unsigned int Depth of the node
+		 */
+		void build(unsigned int begin,
+				   unsigned int end,
+				   unsigned int depth);
+
+		/**
+		 * @brief Searches recursively the nearest point in a range
+		 * @param unsigned int& Id of the nearest point
+		 * @param float& Squared distance to the nearest point
+		 * @param const Eigen::Vector3f& Query point
+		 * @param unsigned int First index of the range
+		 * @param unsigned int Last index (not included) of the range
+		 * @param unsigned int Depth of the node
+		 */
+		void nearest(unsigned int& id,
+					 float& sq_distance,
+					 const Eigen::Vector3f& query,
+					 unsigned int begin,
+					 unsigned int end,
+					 unsigned int depth) const;
+
+		/** @brief Set of points */
+		std::vector<Eigen::Vector3f> points_;
+
+		/** @brief Permutation of the point ids that stores the tree */
+		std::vector<unsigned int> tree_;
+};
+
+} //@namespace dwl_rviz_plugin
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef DWL_RVIZ_PLUGIN__MAP_STREAM__H
+#define DWL_RVIZ_PLUGIN__MAP_STREAM__H
+
+#include <ros/ros.h>
+#include <ros/serialization.h>
+#include <ros/message_traits.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <terrain_server/TerrainMap.h>
+#include <terrain_server/ObstacleMap.h>
+
+#include <OGRE/OgreVector3.h>
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+
+namespace dwl_rviz_plugin
+{
+
+/**
+ * @brief Packs a cost as a half-precision float, which rounds it to 11
+ * significant bits. The costs out of the half range are clamped, and the tiny
+ * costs are flushed to zero
+ * @param double Cost
+ * @return Half-precision cost
+ */
+uint16_t packCost(double cost);
+
+/**
+ * @brief Unpacks a half-precision cost
+ * @param uint16_t Half-precision cost
+ * @return Cost
+ */
+float unpackCost(uint16_t half);
+
+/**
+ * @brief Packs a normal by its octahedral projection, i.e. the normal is
+ * projected on the octahedron |x| + |y| + |z| = 1, whose lower half is folded
+ * over the upper half, and the x and y coordinates are quantized to 16 bits
+ * @param double Normal x component
+ * @param double Normal y component
+ * @param double Normal z component
+ * @return Packed normal
+ */
+uint32_t packNormal(double x,
+					double y,
+					double z);
+
+/**
+ * @brief Unpacks an octahedral normal
+ * @param uint32_t Packed normal
+ * @return Unit normal
+ */
+Ogre::Vector3 unpackNormal(uint32_t normal);
+
+
+/**
+ * @brief Header of a terrain snapshot file, which is followed by the arrays of
+ * the key x, key y, key z, cost and normal of the cells. The costs and normals
+ * are the ones of the compact cells, and each array starts at a multiple of 64
+ * bytes, so the arrays are read in place from the mapped file. The values are
+ * in the byte order of the host
+ */
+struct TerrainSnapshotHeader
+{
+	/** @brief Magic string and version of the format */
+	char magic[8];
+	uint32_t version;
+
+	/** @brief Number of cells of the arrays */
+	uint32_t num_cells;
+
+	/** @brief Resolution, coordinates of the zero keys and ranges of the map */
+	double grid_size;
+	double height_size;
+	double plane_origin;
+	double height_origin;
+	double max_cost;
+	double min_cost;
+	uint32_t min_key_z;
+	uint32_t reserved;
+
+	/** @brief Frame of the map, which is null-terminated */
+	char frame_id[64];
+
+	/** @brief Offsets of the arrays from the start of the file */
+	uint64_t offsets[5];
+};
+
+/**
+ * @brief Terrain map that is parsed from the serialized terrain_server::TerrainMap
+ * message. The cells are streamed from the buffer into arrays of compact values,
+ * i.e. the message is never deserialized as a vector of cells, and the ranges
+ * of the map are computed by the same pass
+ */
+struct TerrainMapStream
+{
+	TerrainMapStream() : plane_size(0.), height_size(0.), max_cost(0.),
+			min_cost(std::numeric_limits<double>::max()),
+			min_key_x(std::numeric_limits<unsigned int>::max()), max_key_x(0),
+			min_key_y(std::numeric_limits<unsigned int>::max()), max_key_y(0),
+			min_key_z(std::numeric_limits<unsigned int>::max()) {}
+
+	typedef boost::shared_ptr<TerrainMapStream> Ptr;
+	typedef boost::shared_ptr<TerrainMapStream const> ConstPtr;
+
+	/** @brief Header of the message */
+	std_msgs::Header header;
+
+	/** @brief Keys, half-precision costs and packed normals of the cells */
+	std::vector<uint16_t> key_x;
+	std::vector<uint16_t> key_y;
+	std::vector<uint16_t> key_z;
+	std::vector<uint16_t> cost;
+	std::vector<uint32_t> normal;
+
+	/** @brief Mapped snapshot, which is decoded instead of the cells. The
+	 * file stays mapped until the last reference is released */
+	boost::shared_ptr<TerrainSnapshotHeader const> snapshot;
+
+	/** @brief Resolution of the map */
+	double plane_size;
+	double height_size;
+
+	/** @brief Cost range and key bounds of the cells */
+	double max_cost;
+	double min_cost;
+	unsigned int min_key_x;
+	unsigned int max_key_x;
+	unsigned int min_key_y;
+	unsigned int max_key_y;
+	unsigned int min_key_z;
+
+	/** @brief Gets the memory size of the cells, in bytes */
+	size_t getSize() const {
+		return key_x.size() * (4 * sizeof(uint16_t) + sizeof(uint32_t));
+	}
+};
+
+/**
+ * @brief Obstacle map that is parsed from the serialized
+ * terrain_server::ObstacleMap message, where the keys of the cells are streamed
+ * into arrays
+ */
+struct ObstacleMapStream
+{
+	ObstacleMapStream() : plane_size(0.), height_size(0.),
+			min_key_z(std::numeric_limits<unsigned int>::max()) {}
+
+	typedef boost::shared_ptr<ObstacleMapStream> Ptr;
+	typedef boost::shared_ptr<ObstacleMapStream const> ConstPtr;
+
+	/** @brief Header of the message */
+	std_msgs::Header header;
+
+	/** @brief Keys of the cells */
+	std::vector<uint16_t> key_x;
+	std::vector<uint16_t> key_y;
+	std::vector<uint16_t> key_z;
+
+	/** @brief Resolution of the map */
+	double plane_size;
+	double height_size;
+
+	/** @brief Minimum key of the height */
+	unsigned int min_key_z;
+
+	/** @brief Gets the memory size of the cells, in bytes */
+	size_t getSize() const {
+		return key_x.size() * 3 * sizeof(uint16_t);
+	}
+};
+
+} //@namespace dwl_rviz_plugin
+
+
+namespace ros
+{
+namespace message_traits
+{
+
+/** @brief The stream types are received as their messages, so they have the
+ * traits of their messages */
+template<> struct IsMessage<dwl_rviz_plugin::TerrainMapStream> : TrueType {};
+template<> struct IsMessage<dwl_rviz_plugin::TerrainMapStream const> : TrueType {};
+template<> struct HasHeader<dwl_rviz_plugin::TerrainMapStream> : TrueType {};
+template<> struct HasHeader<dwl_rviz_plugin::TerrainMapStream const> : TrueType {};
+
+template<>
+struct MD5Sum<dwl_rviz_plugin::TerrainMapStream>
+{
+	static const char* value() { return MD5Sum<terrain_server::TerrainMap>::value(); }
+	static const char* value(const dwl_rviz_plugin::TerrainMapStream&) { return value(); }
+};
+
+template<>
+struct DataType<dwl_rviz_plugin::TerrainMapStream>
+{
+	static const char* value() { return DataType<terrain_server::TerrainMap>::value(); }
+	static const char* value(const dwl_rviz_plugin::TerrainMapStream&) { return value(); }
+};
+
+template<>
+struct Definition<dwl_rviz_plugin::TerrainMapStream>
+{
+	static const char* value() { return Definition<terrain_server::TerrainMap>::value(); }
+	static const char* value(const dwl_rviz_plugin::TerrainMapStream&) { return value(); }
+};
+
+template<> struct IsMessage<dwl_rviz_plugin::ObstacleMapStream> : TrueType {};
+template<> struct IsMessage<dwl_rviz_plugin::ObstacleMapStream const> : TrueType {};
+template<> struct HasHeader<dwl_rviz_plugin::ObstacleMapStream> : TrueType {};
+template<> struct HasHeader<dwl_rviz_plugin::ObstacleMapStream const> : TrueType {};
+
+template<>
+struct MD5Sum<dwl_rviz_plugin::ObstacleMapStream>
+{
+	static const char* value() { return MD5Sum<terrain_server::ObstacleMap>::value(); }
+	static const char* value(const dwl_rviz_plugin::ObstacleMapStream&) { return value(); }
+};
+
+template<>
+struct DataType<dwl_rviz_plugin::ObstacleMapStream>
+{
+	static const char* value() { return DataType<terrain_server::ObstacleMap>::value(); }
+	static const char* value(const dwl_rviz_plugin::ObstacleMapStream&) { return value(); }
+};
+
+template<>
+struct Definition<dwl_rviz_plugin::ObstacleMapStream>
+{
+	static const char* value() { return Definition<terrain_server::ObstacleMap>::value(); }
+	static const char* value(const dwl_rviz_plugin::ObstacleMapStream&) { return value(); }
+};
+
+} //@namespace message_traits
+
+
+namespace serialization
+{
+
+/**
+ * @brief Parser of the serialized terrain map, whose fields are header, cell,
+ * plane_size and height_size. Each cell is read by the serializer of its
+ * message into a local cell, and packed into the arrays. The stream types are
+ * only received, so they don't have a writer
+ */
+template<>
+struct Serializer<dwl_rviz_plugin::TerrainMapStream>
+{
+	template<typename Stream>
+	inline static void read(Stream& stream, dwl_rviz_plugin::TerrainMapStream& msg)
+	{
+		stream.next(msg.header);
+
+		uint32_t num_cells;
+		stream.next(num_cells);
+		msg.key_x.resize(num_cells);
+		msg.key_y.resize(num_cells);
+		msg.key_z.resize(num_cells);
+		msg.cost.resize(num_cells);
+		msg.normal.resize(num_cells);
+		msg.max_cost = 0.;
+		msg.min_cost = std::numeric_limits<double>::max();
+		msg.min_key_x = std::numeric_limits<unsigned int>::max();
+		msg.max_key_x = 0;
+		msg.min_key_y = std::numeric_limits<unsigned int>::max();
+		msg.max_key_y = 0;
+		msg.min_key_z = std::numeric_limits<unsigned int>::max();
+
+		terrain_server::TerrainCell cell;
+		for (uint32_t i = 0; i < num_cells; i++) {
+			stream.next(cell);
+			msg.key_x[i] = cell.key_x;
+			msg.key_y[i] = cell.key_y;
+			msg.key_z[i] = cell.key_z;
+			msg.cost[i] = dwl_rviz_plugin::packCost(cell.cost);
+			msg.normal[i] = dwl_rviz_plugin::packNormal(cell.normal.x, cell.normal.y, cell.normal.z);
+
+			msg.max_cost = std::max(msg.max_cost, cell.cost);
+			msg.min_cost = std::min(msg.min_cost, cell.cost);
+			msg.min_key_x = std::min(msg.min_key_x, (unsigned int) cell.key_x);
+			msg.max_key_x = std::max(msg.max_key_x, (unsigned int) cell.key_x);
+			msg.min_key_y = std::min(msg.min_key_y, (unsigned int) cell.key_y);
+			msg.max_key_y = std::max(msg.max_key_y, (unsigned int) cell.key_y);
+			msg.min_key_z = std::min(msg.min_key_z, (unsigned int) cell.key_z);
+		}
+
+		stream.next(msg.plane_size);
+		stream.next(msg.height_size);
+	}
+};
+
+/** @brief Parser of the serialized obstacle map, whose fields are header,
+ * cell, plane_size and height_size */
+template<>
+struct Serializer<dwl_rviz_plugin::ObstacleMapStream>
+{
+	template<typename Stream>
+	inline static void read(Stream& stream, dwl_rviz_plugin::ObstacleMapStream& msg)
+	{
+		stream.next(msg.header);
+
+		uint32_t num_cells;
+		stream.next(num_cells);
+		msg.key_x.resize(num_cells);
+		msg.key_y.resize(num_cells);
+		msg.key_z.resize(num_cells);
+		msg.min_key_z = std::numeric_limits<unsigned int>::max();
+
+		terrain_server::ObstacleCell cell;
+		for (uint32_t i = 0; i < num_cells; i++) {
+			stream.next(cell);
+			msg.key_x[i] = cell.key_x;
+			msg.key_y[i] = cell.key_y;
+			msg.key_z[i] = cell.key_z;
+			msg.min_key_z = std::min(msg.min_key_z, (unsigned int) cell.key_z);
+		}
+
+		stream.next(msg.plane_size);
+		stream.next(msg.height_size);
+	}
+};
+
+} //@namespace serialization
+} //@namespace ros
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef DWL_RVIZ_PLUGIN__MESSAGE_QUEUE__H
+#define DWL_RVIZ_PLUGIN__MESSAGE_QUEUE__H
+
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <deque>
+#include <utility>
+
+
+namespace dwl_rviz_plugin
+{
+
+/**
+ * @class MessageQueue
+ * @brief Queue of the received messages, which are processed by a worker
+ * thread. The queue is bounded by the bytes of its messages instead of their
+ * number, where the oldest messages are dropped when the budget is exceeded.
+ * In the latest-wins mode a message supersedes the queued messages, so they
+ * are dropped before they are processed. The newest message is always kept.
+ */
+template <typename Message>
+class MessageQueue
+{
+	public:
+		typedef boost::shared_ptr<Message const> MessageConstPtr;
+		typedef boost::function<void (const MessageConstPtr&)> Callback;
+
+		/** @brief Constructor function */
+		MessageQueue() : budget_(0), latest_wins_(true), queued_bytes_(0),
+				num_dropped_(0), running_(false) {}
+
+		/** @brief Destructor function */
+		~MessageQueue()
+		{
+			stop();
+		}
+
+		/**
+		 * @brief Starts the worker thread
+		 * @param Callback Processing of a message
+		 */
+		void start(Callback callback)
+		{
+			stop();
+			callback_ = callback;
+			running_ = true;
+			worker_ = boost::thread(boost::bind(&MessageQueue::process, this));
+		}
+
+		/** @brief Stops the worker thread, which processes the current message
+		 * but not the queued messages */
+		void stop()
+		{
+			{
+				boost::mutex::scoped_lock lock(mutex_);
+				running_ = false;
+			}
+			condition_.notify_all();
+			if (worker_.joinable())
+				worker_.join();
+			clear();
+		}
+
+		/**
+		 * @brief Pushes a message into the queue
+		 * @param const MessageConstPtr& Message
+		 * @param size_t Size of the message, in bytes
+		 */
+		void push(const MessageConstPtr& msg, size_t num_bytes)
+		{
+			{
+				boost::mutex::scoped_lock lock(mutex_);
+				if (latest_wins_)
+					dropMessages(queue_.size());
+				queue_.push_back(std::make_pair(msg, num_bytes));
+				queued_bytes_ += num_bytes;
+				while (queue_.size() > 1 && queued_bytes_ > budget_)
+					dropMessages(1);
+			}
+			condition_.notify_one();
+		}
+
+		/** @brief Drops the queued messages, which aren't counted as dropped */
+		void clear()
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			queue_.clear();
+			queued_bytes_ = 0;
+		}
+
+		/**
+		 * @brief Sets the budget of the queue
+		 * @param size_t Budget, in bytes
+		 */
+		void setBudget(size_t budget)
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			budget_ = budget;
+		}
+
+		/**
+		 * @brief Sets the latest-wins mode, i.e. a message supersedes the
+		 * queued messages
+		 * @param bool Latest-wins mode
+		 */
+		void setLatestWins(bool latest_wins)
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			latest_wins_ = latest_wins;
+		}
+
+		/**
+		 * @brief Gets the state of the queue
+		 * @param size_t& Bytes of the queued messages
+		 * @param unsigned int& Number of dropped messages
+		 */
+		void getState(size_t& queued_bytes,
+					  unsigned int& num_dropped)
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			queued_bytes = queued_bytes_;
+			num_dropped = num_dropped_;
+		}
+
+		/** @brief Resets the number of dropped messages */
+		void resetDropped()
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			num_dropped_ = 0;
+		}
+
+
+	private:
+		/**
+		 * @brief Drops the oldest messages of the queue
+		 * @param unsigned int Number of messages
+		 */
+		void dropMessages(unsigned int num_messages)
+		{
+			for (unsigned int i = 0; i < num_messages; i++) {
+				queued_bytes_ -= queue_.front().second;
+				queue_.pop_front();
+				num_dropped_++;
+			}
+		}
+
+		/** @brief Loop of the worker thread, where a message is processed
+		 * without holding the queue */
+		void process()
+		{
+			while (true) {
+				MessageConstPtr msg;
+				{
+					boost::mutex::scoped_lock lock(mutex_);
+					while (running_ && queue_.empty())
+						condition_.wait(lock);
+					if (!running_)
+						return;
+
+					msg = queue_.front().first;
+					queued_bytes_ -= queue_.front().second;
+					queue_.pop_front();
+				}
+				callback_(msg);
+			}
+		}
+
+		/** @brief Queued messages and their sizes */
+		std::deque<std::pair<MessageConstPtr, size_t> > queue_;
+
+		/** @brief Budget and mode of the queue */
+		size_t budget_;
+		bool latest_wins_;
+
+		/** @brief Bytes of the queued messages and number of dropped messages */
+		size_t queued_bytes_;
+		unsigned int num_dropped_;
+
+		/** @brief Processing of a message, and worker thread */
+		Callback callback_;
+		boost::thread worker_;
+		bool running_;
+
+		/** @brief Mutex and condition of the queue */
+		boost::mutex mutex_;
+		boost::condition_variable condition_;
+};
+
+} //@namespace dwl_rviz_plugin
+
+#endif
@@ -4,18 +4,26 @@
 #include <ros/ros.h>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
 #include <boost/thread/mutex.hpp>
 
 #include <message_filters/subscriber.h>
 
-#include <terrain_server/ObstacleMap.h>
+#include <dwl_rviz_plugin/MapStream.h>
+#include <dwl_rviz_plugin/MessageQueue.h>
 
 #include <rviz/display.h>
 #include <rviz/ogre_helpers/point_cloud.h>
 #include <rviz/properties/color_property.h>
 #include <rviz/properties/float_property.h>
+#include <OGRE/OgreMaterial.h>
 
 
+namespace Ogre
+{
+class ManualObject;
+}
+
 namespace rviz
 {
 
@@ -29,9 +37,34 @@ namespace rviz
 namespace dwl_rviz_plugin
 {
 
+enum ObstacleRenderMode {BOXES, MESH};
+
+/** @brief Quads of the exposed faces of the obstacles, where each quad is four
+ * consecutive vertexs that are counter-clockwise seen from outside */
+struct ObstacleMesh
+{
+	std::vector<Ogre::Vector3> positions;
+	std::vector<Ogre::Vector3> normals;
+};
+
+/** @brief Rectangle of merged faces of a slice of the obstacles, in faces */
+struct FaceRect
+{
+	/** @brief First face and number of faces along u and v */
+	unsigned int u;
+	unsigned int v;
+	unsigned int width;
+	unsigned int height;
+
+	/** @brief Value of the merged faces, e.g. the height of the top faces */
+	unsigned int value;
+};
+
 /**
  * @class ObstacleMapDisplay
  * @brief Rviz plugin for visualization of obstacle map of the environment
+ * The obstacles are drawn as a box per voxel, or as a mesh of their exposed
+ * faces, where the coplanar faces are merged by greedy meshing.
  */
 class ObstacleMapDisplay : public rviz::Display
 {
@@ -70,8 +103,68 @@ class ObstacleMapDisplay : public rviz::Display
 		/** @brief Unsubscribes to the topic */
 		void unsubscribe();
 
-		/** @brief Proccesing of the incoming message */
-		void incomingMessageCallback(const terrain_server::ObstacleMapConstPtr& msg);
+		/** @brief Queues the incoming message, which is processed by the
+		 * worker thread unless a later message supersedes it */
+		void incomingMessageCallback(const ObstacleMapStream::ConstPtr& msg);
+
+		/** @brief Proccesing of a queued message, in the worker thread */
+		void processMessage(const ObstacleMapStream::ConstPtr& msg);
+
+		/** @brief Shows the queued bytes and the dropped messages when they
+		 * changed */
+		void updateQueueStatus();
+
+		/** @brief Sets the transform of the scene node from the header of the
+		 * last processed message, in the GUI thread */
+		void updateTransform();
+
+		/**
+		 * @brief Builds the mesh of the exposed faces of the obstacles. Each
+		 * cell is solid from its height key down to the lowest key, so the
+		 * obstacles are a field of column heights, whose top, bottom and side
+		 * faces are merged by greedy meshing
+		 * @param const ObstacleMapStream& Parsed obstacle message
+		 * @param unsigned int Minimum key of the height
+		 */
+		void buildMesh(const ObstacleMapStream& msg,
+					   unsigned int min_key_z);
+
+		/**
+		 * @brief Adds the side faces of the columns that face an axis, i.e.
+		 * the faces between a column and its lower neighbour for each plane
+		 * across the axis
+		 * @param const std::vector<unsigned int>& Column heights, in voxels
+		 * @param unsigned int Number of columns along x
+		 * @param unsigned int Number of columns along y
+		 * @param unsigned int Maximum column height
+		 * @param unsigned int Axis, i.e. 0 for x and 1 for y
+		 * @param const Ogre::Vector3& Lowest corner of the columns
+		 */
+		void addSideFaces(const std::vector<unsigned int>& heights,
+						  unsigned int size_x,
+						  unsigned int size_y,
+						  unsigned int max_height,
+						  unsigned int axis,
+						  const Ogre::Vector3& corner);
+
+		/**
+		 * @brief Adds the quads of a set of merged faces into the mesh buffer
+		 * @param const std::vector<FaceRect>& Merged faces
+		 * @param const Ogre::Vector3& Corner of the slice
+		 * @param const Ogre::Vector3& Size of a face along u
+		 * @param const Ogre::Vector3& Size of a face along v
+		 * @param const Ogre::Vector3& Offset of the faces per unit of their value
+		 * @param const Ogre::Vector3& Normal of the faces
+		 */
+		void addQuads(const std::vector<FaceRect>& rects,
+					  const Ogre::Vector3& corner,
+					  const Ogre::Vector3& u_size,
+					  const Ogre::Vector3& v_size,
+					  const Ogre::Vector3& value_offset,
+					  const Ogre::Vector3& normal);
+
+		/** @brief Draws the received mesh */
+		void drawMesh();
 
 		/** Clears the display data */
 		void clear();
@@ -80,7 +173,16 @@ class ObstacleMapDisplay : public rviz::Display
 		typedef std::vector<rviz::PointCloud::Point> VPoint;
 
 		/** @brief Subscriber to the ObstacleMap messages */
-		boost::shared_ptr<message_filters::Subscriber<terrain_server::ObstacleMap> > sub_;
+		boost::shared_ptr<message_filters::Subscriber<ObstacleMapStream> > sub_;
+
+		/** @brief Queue of the received messages, which are processed by its
+		 * worker thread */
+		MessageQueue<ObstacleMapStream> queue_;
+
+		/** @brief Queued bytes and dropped messages of the status, which is
+		 * shown again when they change */
+		size_t status_queued_bytes_;
+		unsigned int status_dropped_;
 
 		/** @brief Mutex of thread */
 		boost::mutex mutex_;
@@ -88,12 +190,20 @@ class ObstacleMapDisplay : public rviz::Display
 		/** @brief Ogre-rviz point clouds */
 		rviz::PointCloud* cloud_;
 
+		/** @brief Mesh of the exposed faces and its material, which is lit */
+		boost::shared_ptr<Ogre::ManualObject> mesh_object_;
+		Ogre::MaterialPtr mesh_material_;
+
 		/** @brief Plugin properties */
 		rviz::IntProperty* queue_size_property_;
+		rviz::IntProperty* queue_budget_property_;
 
 		/** @brief Obstacle map topic properties */
 		rviz::RosTopicProperty* obstaclemap_topic_property_;
 
+		/** @brief Render mode property */
+		rviz::EnumProperty* render_mode_property_;
+
 		/** @brief Plugin color properties */
 		rviz::ColorProperty* color_property_;
 
@@ -109,9 +219,29 @@ class ObstacleMapDisplay : public rviz::Display
 		/** @brief Point buffer */
 		VPoint point_buf_;
 
+		/** @brief New mesh and mesh buffer */
+		ObstacleMesh new_mesh_;
+		ObstacleMesh mesh_buf_;
+
+		/** @brief Render mode, which is set by the GUI thread */
+		boost::atomic<int> render_mode_;
+
+		/** @brief Last received message, which is processed again when the
+		 * render mode changes */
+		ObstacleMapStream::ConstPtr last_msg_;
+
 		/** @brief Indicates if the new points was received */
 		bool new_points_received_;
 
+		/** @brief Header of the last processed message, which is recorded by
+		 * the worker thread, and header of the drawn points */
+		std_msgs::Header new_header_;
+		std_msgs::Header header_;
+
+		/** @brief Indicates if the transform of the drawn points is pending,
+		 * i.e. their frame wasn't available yet */
+		bool transform_pending_;
+
 		/** @brief Queue size */
 		u_int32_t queue_size_;
 
@@ -124,6 +254,12 @@ class ObstacleMapDisplay : public rviz::Display
 		/** @brief Height size */
 		double height_size_;
 
+		/** @brief Grid and height sizes of the last processed message, which
+		 * are recorded by the worker thread, since the sizes above are only
+		 * used by the worker thread */
+		double new_grid_size_;
+		double new_height_size_;
+
 		/** @brief Color value */
 		Ogre::ColourValue color_;
 
@@ -134,9 +270,15 @@ class ObstacleMapDisplay : public rviz::Display
 		/** @brief Updates queue size */
 		void updateQueueSize();
 
+		/** @brief Updates the byte budget of the queue */
+		void updateQueueBudget();
+
 		/** @brief Updates the topic name */
 		void updateTopic();
 
+		/** @brief Updates the render mode */
+		void updateRenderMode();
+
 		/** @brief Updates the color */
 		void updateColor();
 };
@@ -54,6 +54,12 @@ class PointVisual
 		 */
 		void setFrameOrientation(const Ogre::Quaternion& orientation);
 
+		/**
+		 * @brief Set the visibility of the visual
+		 * @param bool Visible flag
+		 */
+		void setVisible(bool visible);
+
 		/**
 		 * @brief Set the color and alpha of the visual, which are user-editable
 		 * @param float Red value
@@ -64,6 +64,12 @@ class PolygonVisual
 		 */
 		void setFrameOrientation(const Ogre::Quaternion& orientation);
 
+		/**
+		 * @brief Set the visibility of the visual
+		 * @param bool Visible flag
+		 */
+		void setVisible(bool visible);
+
 		/**
 		 * @brief Set the line color and alpha, which are user-editable
 		 * @param float Red value
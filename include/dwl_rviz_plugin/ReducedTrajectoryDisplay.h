@@ -1,7 +1,13 @@
 #ifndef DWL_RVIZ_PLUGIN__REDUCED_TRAJECTORY_DISPLAY__H
 #define DWL_RVIZ_PLUGIN__REDUCED_TRAJECTORY_DISPLAY__H
 
+#ifndef Q_MOC_RUN
+#include <boost/circular_buffer.hpp>
+#endif
+
 #include <rviz/message_filter_display.h>
+#include <OgreMaterial.h>
+#include <OgreQuaternion.h>
 #include <dwl_rviz_plugin/PointVisual.h>
 #include <dwl_rviz_plugin/ArrowVisual.h>
 #include <dwl_rviz_plugin/PolygonVisual.h>
@@ -17,11 +23,13 @@ class ManualObject;
 namespace rviz
 {
 
+class BoolProperty;
 class ColorProperty;
 class FloatProperty;
 class IntProperty;
 class EnumProperty;
 class BillboardLine;
+class PointCloud;
 class VectorProperty;
 
 } //@namespace rviz
@@ -32,6 +40,47 @@ namespace dwl_rviz_plugin
 
 enum ModeDisplay {REALTIME, FULL, LOOP};
 
+/** @brief Policies for the trajectories that arrive during a playback */
+enum QueuePolicy {PREEMPT, FINISH_LATEST, QUEUE};
+
+/**
+ * @brief Geometry of a reduced trajectory, which is computed once per message
+ * The index 0 is the actual state and the index k the (k-1)-th state of the
+ * trajectory.
+ */
+struct ReducedTrajectoryGeometry
+{
+	/** @brief Gets the number of states */
+	unsigned int size() const { return time.size(); }
+
+	/** @brief Time, CoM and CoP positions of the states */
+	std::vector<double> time;
+	std::vector<Ogre::Vector3> com;
+	std::vector<Ogre::Vector3> cop;
+
+	/** @brief Support region vertices of all the states, where the vertices of
+	 * the state k are in [support_idx[k], support_idx[k+1]) */
+	std::vector<unsigned int> support_idx;
+	std::vector<Ogre::Vector3> support;
+
+	/** @brief Orientation and length of the pendulum from the CoP to the CoM */
+	std::vector<Ogre::Quaternion> pendulum_orientation;
+	std::vector<float> pendulum_length;
+
+	/** @brief Color of the states */
+	std::vector<Ogre::ColourValue> colour;
+};
+
+/** @brief Visuals of all the states of a trajectory, which are built while
+ * the trajectory is queued, so starting its playback only swaps them in */
+struct ReducedTrajectoryVisuals
+{
+	std::vector<boost::shared_ptr<PointVisual> > com;
+	std::vector<boost::shared_ptr<PointVisual> > cop;
+	std::vector<boost::shared_ptr<PolygonVisual> > support;
+	std::vector<boost::shared_ptr<ArrowVisual> > pendulum;
+};
+
 /**
  * @class ReducedTrajectoryDisplay
  * @brief Displays a dwl_msgs::ReducedTrajectory message
@@ -74,6 +123,7 @@ class ReducedTrajectoryDisplay :
 		void updateCoPRadiusAndAlpha();
 		void updateSupportAlpha();
 		void updatePendulumArrowGeometry();
+		void updateQueuePolicy();
 
 
 
@@ -84,14 +134,87 @@ class ReducedTrajectoryDisplay :
 		/** @brief Update the information to be display */
 		void updateDisplay();
 
-		/** @brief Display the state */
-		void displayState(dwl_msgs::ReducedBodyState& state);
+		/**
+		 * @brief Starts the playback of a trajectory
+		 * @param const dwl_msgs::ReducedBodyTrajectory::ConstPtr& Reduced trajectory msg
+		 * @param const boost::shared_ptr<ReducedTrajectoryGeometry>& Geometry of
+		 * the trajectory
+		 * @param const boost::shared_ptr<ReducedTrajectoryVisuals>& Visuals of
+		 * the states that were built while the trajectory was queued, if any
+		 */
+		void playTrajectory(const dwl_msgs::ReducedBodyTrajectory::ConstPtr& msg,
+							const boost::shared_ptr<ReducedTrajectoryGeometry>& geometry,
+							const boost::shared_ptr<ReducedTrajectoryVisuals>& visuals);
+
+		/** @brief Starts the playback of the oldest queued trajectory */
+		void playNextTrajectory();
+
+		/**
+		 * @brief Computes the geometry of all the states of a trajectory
+		 * @param ReducedTrajectoryGeometry& Geometry of the trajectory
+		 * @param const dwl_msgs::ReducedBodyTrajectory& Reduced trajectory
+		 */
+		void computeGeometry(ReducedTrajectoryGeometry& geometry,
+							 const dwl_msgs::ReducedBodyTrajectory& msg);
+
+		/** @brief Creates the visuals of all the states, which are hidden */
+		void createObjects();
+
+		/**
+		 * @brief Creates the hidden visuals of all the states of a trajectory,
+		 * whose frame, colors and sizes are set when they are swapped in
+		 * @param ReducedTrajectoryVisuals& Visuals of the states
+		 * @param const ReducedTrajectoryGeometry& Geometry of the trajectory
+		 */
+		void createStateVisuals(ReducedTrajectoryVisuals& visuals,
+								const ReducedTrajectoryGeometry& geometry);
+
+		/** @brief Sets the frame, colors and sizes of all the visuals */
+		void updateObjects();
+
+		/** @brief Creates the batched objects that display all the states in
+		 * full mode */
+		void createFullObjects();
+
+		/** @brief Fills the batched support lines and mesh of full mode */
+		void updateFullSupport();
+
+		/** @brief Fills the batched pendulum lines of full mode */
+		void updateFullPendulum();
+
+		/** @brief Creates the visuals of the interpolated state */
+		void createInterpolatedObjects();
+
+		/**
+		 * @brief Updates the visuals of the interpolated state. The CoM and CoP
+		 * are linearly interpolated between consecutive states, and the support
+		 * region is morphed when both states have the same number of vertexs
+		 * @param double Time of the interpolated state
+		 */
+		void interpolateState(double time);
+
+		/** @brief Updates the frame of all the visuals */
+		void updateFrameTransform();
+
+		/**
+		 * @brief Sets the visibility of the visuals of a state
+		 * @param unsigned int State index
+		 * @param bool Visible flag
+		 */
+		void setStateVisible(unsigned int idx, bool visible);
+
+		/**
+		 * @brief Shows only the visuals of a state
+		 * @param unsigned int State index
+		 */
+		void showState(unsigned int idx);
 		
 		/** @brief Message pointer */
 		dwl_msgs::ReducedBodyTrajectory::ConstPtr msg_;
 
-		/** @brief Message time uses to display at the right moment */
-		float msg_time_;
+		/** @brief Playback clock, in the time of the trajectory, used to
+		 * display the right state at each frame */
+		double msg_time_;
 
 		/** @brief Indicates if there is a received message */
 		bool received_msg_;
@@ -99,9 +222,17 @@ class ReducedTrajectoryDisplay :
 		/** @brief Indicates when there is a new message */
 		bool new_msg_;
 
-		/** @brief State index to be display */
-		int display_idx_;
-		bool next_;
+		/** @brief State index that is currently shown, -1 if none */
+		int shown_idx_;
+
+		/** @brief Geometry of the trajectory in playback */
+		boost::shared_ptr<ReducedTrajectoryGeometry> geometry_;
+
+		/** @brief Trajectories, and their geometries, that wait for the end of
+		 * the playback */
+		boost::circular_buffer<dwl_msgs::ReducedBodyTrajectory::ConstPtr> queue_msgs_;
+		boost::circular_buffer<boost::shared_ptr<ReducedTrajectoryGeometry> > queue_geometry_;
+		boost::circular_buffer<boost::shared_ptr<ReducedTrajectoryVisuals> > queue_visuals_;
 
 		/**
 		 * @brief Generate a set of colors given a number of points
@@ -121,13 +252,38 @@ class ReducedTrajectoryDisplay :
 		/** @brief Object for visualization of the data */
 		std::vector<boost::shared_ptr<PointVisual> > com_visual_;
 		std::vector<boost::shared_ptr<PointVisual> > cop_visual_;
-		std::vector<PolygonVisual*> support_visual_;
+		std::vector<boost::shared_ptr<PolygonVisual> > support_visual_;
 		std::vector<boost::shared_ptr<ArrowVisual> > pendulum_visual_;
 
+		/** @brief Batched objects for the full mode, i.e. a point cloud for the
+		 * CoM and CoP, lines for the support region and pendulum, and a mesh with
+		 * per-vertex colors for the support region. The batched objects are
+		 * attached to a node in the frame of the message */
+		Ogre::SceneNode* batch_node_;
+		boost::shared_ptr<rviz::PointCloud> full_com_cloud_;
+		boost::shared_ptr<rviz::PointCloud> full_cop_cloud_;
+		boost::shared_ptr<rviz::BillboardLine> full_support_line_;
+		boost::shared_ptr<rviz::BillboardLine> full_pendulum_line_;
+		boost::shared_ptr<Ogre::ManualObject> full_support_mesh_;
+		Ogre::MaterialPtr support_material_;
+
+		/** @brief Objects for visualization of the interpolated state, the
+		 * support vertexs buffer is sized for the largest support region */
+		boost::shared_ptr<PointVisual> interp_com_visual_;
+		boost::shared_ptr<PointVisual> interp_cop_visual_;
+		boost::shared_ptr<ArrowVisual> interp_pendulum_visual_;
+		boost::shared_ptr<rviz::BillboardLine> interp_support_line_;
+		boost::shared_ptr<Ogre::ManualObject> interp_support_mesh_;
+		std::vector<Ogre::Vector3> interp_support_;
+		unsigned int interp_support_size_;
+
 
 		/** @brief Property objects for user-editable properties */
 		rviz::EnumProperty* mode_display_property_;
 		rviz::FloatProperty* rt_factor_property_;
+		rviz::BoolProperty* interpolation_property_;
+		rviz::EnumProperty* queue_policy_property_;
+		rviz::IntProperty* queue_size_property_;
 
 		rviz::FloatProperty* com_alpha_property_;
 		rviz::FloatProperty* com_radius_property_;
@@ -144,6 +300,8 @@ class ReducedTrajectoryDisplay :
 
 		ModeDisplay mode_display_;
 		float rt_factor_;
+		bool interpolation_;
+		QueuePolicy queue_policy_;
 		float com_radius_;
 		float com_alpha_;
 		float cop_radius_;
@@ -151,7 +309,6 @@ class ReducedTrajectoryDisplay :
 		float support_line_alpha_;
 		float support_mesh_alpha_;
 		float pendulum_alpha_;
-		std::vector<Ogre::ColourValue> colours_;
 };
 
 } //@namespace dwl_rviz_plugin
@@ -4,22 +4,35 @@
 #include <ros/ros.h>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
 
 #include <message_filters/subscriber.h>
 
-#include <terrain_server/TerrainMap.h>
-#include <dwl_rviz_plugin/ArrowVisual.h>
+#include <dwl_rviz_plugin/MapStream.h>
+#include <dwl_rviz_plugin/MessageQueue.h>
+#include <dwl_rviz_plugin/Colormap.h>
 
 #include <rviz/display.h>
 #include <rviz/ogre_helpers/point_cloud.h>
+#include <OGRE/OgreMaterial.h>
+#include <OGRE/OgreTexture.h>
+#include <OGRE/OgreAxisAlignedBox.h>
 
 
+namespace Ogre
+{
+class ManualObject;
+class SceneNode;
+}
+
 namespace rviz
 {
 class RosTopicProperty;
 class IntProperty;
 class FloatProperty;
+class StringProperty;
 class ColorProperty;
 class EnumProperty;
 } //@namespace rviz
@@ -28,21 +41,211 @@ class EnumProperty;
 namespace dwl_rviz_plugin
 {
 
-struct Normal
+enum TerrainRenderMode {VOXELS, COLUMNS, SURFACE};
+
+/** @brief Tile bounds of the decoded cells */
+struct TerrainCellRange
+{
+	/** @brief Tile coordinates bounds of the cells */
+	unsigned int min_tile_x;
+	unsigned int max_tile_x;
+	unsigned int min_tile_y;
+	unsigned int max_tile_y;
+};
+
+/** @brief Arrays of the decoded cells, which are the arrays of a parsed
+ * message or of a mapped snapshot */
+struct TerrainCellArrays
+{
+	const uint16_t* key_x;
+	const uint16_t* key_y;
+	const uint16_t* key_z;
+	const uint16_t* cost;
+	const uint32_t* normal;
+	unsigned int num_cells;
+};
+
+/** @brief Column of voxels of a cell, which is drawn as one stretched box or
+ * as a vertex of the surface mesh */
+struct Column
+{
+	/** @brief Center of the top face and height of the bottom face */
+	Ogre::Vector3 top;
+	float bottom;
+
+	/** @brief Cost of the cell, which is mapped to a color by the colormap */
+	float cost;
+
+	/** @brief Surface normal of the cell */
+	Ogre::Vector3 normal;
+};
+
+/**
+ * @brief Compact cell, which has the height key, the cost as a half-precision
+ * float and the unit normal packed in 32 bits. The horizontal keys are given by
+ * the slot of the cell, so a cell takes 8 bytes, and it's expanded to vertexs
+ * and voxels only when its tile is drawn
+ */
+struct CompactCell
 {
-	void setNormal(Ogre::Vector3 position,
-				   Ogre::Quaternion quaternion) {
-		origin = position;
-		orientation = quaternion;
+	CompactCell() : key_z(0), cost(0), normal(0) {}
+
+	bool operator!=(const CompactCell& other) const {
+		return key_z != other.key_z || cost != other.cost || normal != other.normal;
 	}
 
-	Ogre::Vector3 origin;
-	Ogre::Quaternion orientation;
+	uint16_t key_z;
+	uint16_t cost;
+	uint32_t normal;
+};
+
+/** @brief Slot of a cell in the persistent buffers, which keeps the last
+ * received values of the cell in order to find the changed cells */
+struct TerrainCellSlot
+{
+	TerrainCellSlot() : used(false), dirty(false), stamp(0) {}
+
+	/** @brief Last received values of the cell */
+	CompactCell cell;
+
+	/** @brief Indicates if the slot has a cell, and if it has to be rewritten
+	 * in the buffers */
+	bool used;
+	bool dirty;
+
+	/** @brief Number of the last message that had the cell */
+	unsigned int stamp;
+};
+
+/** @brief Information of a decoded terrain map */
+struct TerrainMapInfo
+{
+	TerrainMapInfo() : num_messages(0), grid_size(0.), height_size(0.),
+			max_cost(0.), min_cost(0.), plane_origin(0.), height_origin(0.),
+			min_key_z(0), num_tiles(0), num_evicted(0) {}
+
+	/** @brief Header of the message, which gives the transform of the map */
+	std_msgs::Header header;
+
+	/** @brief Number of decoded messages */
+	unsigned int num_messages;
+
+	/** @brief Resolution and cost range of the map */
+	double grid_size;
+	double height_size;
+	double max_cost;
+	double min_cost;
+
+	/** @brief Coordinates of the zero keys, and the lowest height key, which
+	 * expand the keys of the cells */
+	double plane_origin;
+	double height_origin;
+	unsigned int min_key_z;
+
+	/** @brief Number of tiles with cells, and of evicted tiles */
+	unsigned int num_tiles;
+	unsigned int num_evicted;
+};
+
+/**
+ * @brief Decoded terrain map that is handed from the callback thread to the
+ * render thread. It has the changes of the slots since the last frame that the
+ * render thread took, so the render thread only copies the dirty slots. The
+ * voxels are expanded from the cells by the render thread
+ */
+struct TerrainMapFrame
+{
+	TerrainMapFrame() : generation(0), full_rewrite(false) {}
+
+	/** @brief Generation of the decoded state, i.e. the number of clears */
+	unsigned int generation;
+
+	/** @brief Information of the map */
+	TerrainMapInfo info;
+
+	/** @brief Key and number of cells of each tile, where the key is
+	 * (tile_x << 16 | tile_y) */
+	std::vector<uint32_t> tile_keys;
+	std::vector<unsigned int> tile_cells;
+
+	/** @brief Sorted dirty slots, and their cell flag and cell */
+	std::vector<unsigned int> dirty_slots;
+	std::vector<char> used;
+	std::vector<CompactCell> cells;
+
+	/** @brief Indicates if all the buffers have to be built again */
+	bool full_rewrite;
+};
+
+/**
+ * @brief Square tile of cells that has its own meshes and voxels. Ogre culls
+ * the objects of a tile by their bounding box, and only the tiles that have
+ * changed cells are written again. A far tile is drawn at a coarser level,
+ * whose cells are blocks of cells
+ */
+struct TerrainTile
+{
+	TerrainTile() : index(0), key(0), num_cells(0), redraw_all(true),
+			retriangulate(true), node(NULL), voxels_changed(false),
+			voxels_recolored(false), level(0) {}
+
+	/** @brief Index of the tile, where its first slot is the index times the
+	 * number of cells of a tile */
+	unsigned int index;
+
+	/** @brief Key and number of cells of the tile */
+	uint32_t key;
+	unsigned int num_cells;
+
+	/** @brief Dirty cells and surface vertexs of the tile, and if all the
+	 * meshes have to be built again or the surface triangles changed */
+	std::vector<unsigned int> redraw_cells;
+	std::vector<unsigned int> redraw_vertexs;
+	bool redraw_all;
+	bool retriangulate;
+
+	/** @brief Node of the tile, whose box is the box of the tile objects, so
+	 * Ogre culls the tiles that are off screen */
+	Ogre::SceneNode* node;
+
+	/** @brief Meshes of the columns, surface and normals */
+	boost::shared_ptr<Ogre::ManualObject> column_object;
+	boost::shared_ptr<Ogre::ManualObject> surface_object;
+	boost::shared_ptr<Ogre::ManualObject> normal_object;
+
+	/** @brief Voxels of the tile, which are expanded from the cells when
+	 * they changed. The expanded voxels and their costs are kept, so a new
+	 * colormap only colors them again */
+	boost::shared_ptr<rviz::PointCloud> cloud;
+	std::vector<rviz::PointCloud::Point> voxels;
+	std::vector<float> voxel_costs;
+	bool voxels_changed;
+	bool voxels_recolored;
+
+	/** @brief Columns and cell flags of the levels of the tile, where a cell
+	 * of the level l is a block of 2^l x 2^l cells with their maximum height,
+	 * mean cost and mean normal. The level 0 is the slots of the tile, so its
+	 * vectors are empty */
+	std::vector<std::vector<Column> > level_columns;
+	std::vector<std::vector<char> > level_used;
+
+	/** @brief Bounding box of the cells, which gives the distance to the
+	 * camera */
+	Ogre::AxisAlignedBox box;
+
+	/** @brief Drawn level of the tile */
+	unsigned int level;
 };
 
 /**
  * @class TerrainMapDisplay
  * @brief Rviz plugin for visualization of terrain map
+ * The callback thread queues the messages in a byte-budgeted queue, and a
+ * worker thread decodes the last messages into frames, and publishes them by
+ * an atomic pointer swap. The render thread takes the last frame in update(),
+ * and it owns the transform, the scene objects and their buffers, so it never
+ * waits on the decoding. The cells are grouped in tiles, which are the unit of
+ * culling, of incremental update and of level of detail.
  */
 class TerrainMapDisplay : public rviz::Display
 {
@@ -84,70 +287,523 @@ class TerrainMapDisplay : public rviz::Display
 		/** @brief Unsubscribes to the topic */
 		void unsubscribe();
 
-		/** @brief Processing of the incoming message */
-		void incomingMessageCallback(const terrain_server::TerrainMapConstPtr& msg);
+		/** @brief Queues the incoming message, which is decoded by the worker
+		 * thread unless a later message supersedes it */
+		void incomingMessageCallback(const TerrainMapStream::ConstPtr& msg);
+
+		/** @brief Decodes a queued message, which runs in the worker thread */
+		void processMessage(const TerrainMapStream::ConstPtr& msg);
+
+		/** @brief Shows the queued bytes and the dropped messages when they
+		 * changed */
+		void updateQueueStatus();
+
+		/**
+		 * @brief Drops the decoded state when the display was cleared, and
+		 * takes back the frame that the render thread didn't take. The changes
+		 * of the taken back frame are published again by the next frame
+		 */
+		void reclaimFrame();
+
+		/** @brief Writes the dirty slots into a new frame and publishes it */
+		void publishFrame();
+
+		/**
+		 * @brief Decodes the cells of the parsed terrain message into their
+		 * slots. The cost and height ranges were computed by the parser, and a
+		 * diff pass finds the slot of each cell by its tile and its place in the
+		 * tile, where only the added, removed or changed cells are marked as
+		 * dirty. All the slots are dirty when the resolution or ranges of the
+		 * map changed
+		 * @param const TerrainMapStream& Parsed terrain message
+		 */
+		void decodeMap(const TerrainMapStream& msg);
+
+		/**
+		 * @brief Grows the ring of tiles of the rolling window when it doesn't
+		 * cover the decoded cells. The tiles of a grown ring are addressed
+		 * again, so all the slots are rewritten
+		 * @param const TerrainCellRange& Bounds of the decoded cells
+		 */
+		void fitRing(const TerrainCellRange& bounds);
+
+		/**
+		 * @brief Gets the tile of a tile key in the ring of the rolling window,
+		 * i.e. the tile at the key modulo the ring size. The cells of the tile
+		 * that left the window are removed when the tile is taken by the key
+		 * @param uint32_t Tile key
+		 * @return Tile index
+		 */
+		unsigned int takeRingTile(uint32_t tile_key);
+
+		/**
+		 * @brief Evicts the tiles of the accumulated map that don't fit in the
+		 * memory budget, from the least recently seen and the farthest from
+		 * the robot. The tiles of the last message are kept
+		 * @param const TerrainCellRange& Bounds of the last message, whose
+		 * center is the robot
+		 */
+		void evictTiles(const TerrainCellRange& bounds);
+
+		/**
+		 * @brief Gets the tile of a tile key, where a new tile takes a free
+		 * tile or its place in the ring
+		 * @param uint32_t Tile key
+		 * @return Tile index
+		 */
+		unsigned int takeTile(uint32_t tile_key);
+
+		/**
+		 * @brief Stores the cells in their slots, which are marked as dirty
+		 * when their cells are new or changed. The tiles of the cells are
+		 * taken by a serial pass, and the slots are written by parallel
+		 * threads that each have a share of the tiles
+		 * @param const TerrainCellArrays& Decoded cells
+		 */
+		void storeCells(const TerrainCellArrays& cells);
+
+		/**
+		 * @brief Stores the cells of the tiles of a thread, i.e. the tiles
+		 * whose index modulo the number of threads is the thread
+		 * @param const TerrainCellArrays& Decoded cells
+		 * @param unsigned int Thread
+		 * @param unsigned int Number of threads
+		 */
+		void storeTileCells(const TerrainCellArrays& cells,
+							unsigned int thread,
+							unsigned int num_threads);
+
+		/**
+		 * @brief Removes the cells that weren't stored by the last decoding,
+		 * or evicts the tiles in the accumulate mode. The slots are scanned by
+		 * parallel threads that each have a range of tiles
+		 * @param const TerrainCellRange& Bounds of the decoded cells
+		 */
+		void removeCells(const TerrainCellRange& bounds);
+
+		/**
+		 * @brief Removes the cells that weren't stored from a range of tiles
+		 * @param unsigned int First tile
+		 * @param unsigned int End tile
+		 * @param unsigned int Thread
+		 */
+		void removeTileCells(unsigned int first_tile,
+							 unsigned int end_tile,
+							 unsigned int thread);
+
+		/**
+		 * @brief Merges the dirty slots of the threads into the dirty slots
+		 * @param unsigned int Number of threads
+		 */
+		void mergeDirtySlots(unsigned int num_threads);
+
+		/**
+		 * @brief Decodes the cells of a mapped snapshot into their slots, where
+		 * the arrays of the snapshot are read in place
+		 * @param const TerrainSnapshotHeader& Header of the mapped snapshot
+		 */
+		void decodeSnapshot(const TerrainSnapshotHeader& snapshot);
+
+		/**
+		 * @brief Saves the cells of the render thread as a snapshot
+		 * @param const std::string& File name
+		 */
+		void saveSnapshot(const std::string& file_name);
+
+		/**
+		 * @brief Maps a snapshot file, and queues it as a message, so it's
+		 * decoded by the worker thread
+		 * @param const std::string& File name
+		 */
+		void loadSnapshot(const std::string& file_name);
+
+		/**
+		 * @brief Marks a slot as dirty
+		 * @param unsigned int Slot index
+		 */
+		void markDirty(unsigned int slot);
+
+		/**
+		 * @brief Marks a slot as dirty, where the slot is added to a list of
+		 * dirty slots of a thread
+		 * @param unsigned int Slot index
+		 * @param std::vector<unsigned int>& Dirty slots of the thread
+		 */
+		void markDirty(unsigned int slot,
+					   std::vector<unsigned int>& dirty_slots);
+
+		/** @brief Marks all the slots as dirty, so the buffers are built again */
+		void markAllDirty();
+
+		/**
+		 * @brief Copies the dirty slots of a frame into the buffers of the
+		 * render thread, and marks the cells of their tiles to be written again
+		 * @param TerrainMapFrame& Frame, whose buffers are taken
+		 */
+		void applyFrame(TerrainMapFrame& frame);
+
+		/**
+		 * @brief Creates the objects of a tile
+		 * @param TerrainTile& Tile
+		 */
+		void createTile(TerrainTile& tile);
+
+		/**
+		 * @brief Attaches the objects of a tile to a new node of the tile,
+		 * which replaces its previous node
+		 * @param TerrainTile& Tile
+		 */
+		void attachTile(TerrainTile& tile);
+
+		/**
+		 * @brief Destroys the node of a tile, which detaches its objects
+		 * @param TerrainTile& Tile
+		 */
+		void destroyTileNode(TerrainTile& tile);
+
+		/**
+		 * @brief Gets the index of a tile from its coordinates
+		 * @param int Tile x coordinate
+		 * @param int Tile y coordinate
+		 * @return Tile index, or -1 if the tile has no cells
+		 */
+		int getTile(int tile_x,
+					int tile_y) const;
+
+		/**
+		 * @brief Builds the levels of the tiles that changed, and chooses the
+		 * level of each tile from its distance to the camera. A tile that
+		 * changed its level is built again
+		 */
+		void updateLevels();
+
+		/**
+		 * @brief Builds the coarser levels of a tile, where each level is
+		 * aggregated from the previous one
+		 * @param TerrainTile& Tile
+		 */
+		void buildLevels(TerrainTile& tile);
+
+		/**
+		 * @brief Selects the level of a tile, i.e. the finest level whose
+		 * cells are projected at least the LOD pixel size
+		 * @param const TerrainTile& Tile
+		 * @param const Ogre::Vector3& Camera position in the map frame
+		 * @param float Pixels per meter at a distance of one meter
+		 * @return Level of the tile
+		 */
+		unsigned int selectLevel(const TerrainTile& tile,
+								 const Ogre::Vector3& camera_position,
+								 float pixel_scale) const;
+
+		/**
+		 * @brief Gets a cell of a level of a tile, where the cells of the
+		 * level 0 are expanded from their compact cells
+		 * @param const TerrainTile& Tile
+		 * @param unsigned int Level
+		 * @param unsigned int Cell x coordinate in the level
+		 * @param unsigned int Cell y coordinate in the level
+		 * @param bool& Indicates if the cell is used
+		 * @return Column of the cell
+		 */
+		Column getTileCell(const TerrainTile& tile,
+						   unsigned int level,
+						   unsigned int x,
+						   unsigned int y,
+						   bool& used) const;
+
+		/**
+		 * @brief Marks a surface vertex of a tile to be written again
+		 * @param int Tile index, which is ignored if it's negative
+		 * @param unsigned int Vertex index in the tile
+		 * @param bool Indicates if the cell was added or removed
+		 */
+		void markSurfaceVertex(int tile,
+							   unsigned int vertex,
+							   bool topology_changed);
+
+		/** @brief Sets the transform of the scene node from the header of the
+		 * map, and it's tried again at each update while it fails */
+		void updateTransform();
+
+		/**
+		 * @brief Expands the voxels of the cells of a tile at its level, and
+		 * colors them from their costs
+		 * @param TerrainTile& Tile
+		 */
+		void drawVoxels(TerrainTile& tile);
+
+		/**
+		 * @brief Colors the expanded voxels of a tile from their costs, and
+		 * adds them to the point cloud
+		 * @param TerrainTile& Tile
+		 */
+		void colorVoxels(TerrainTile& tile);
+
+		/** @brief Creates the colormap textures of all the color modes */
+		void createColormaps();
+
+		/**
+		 * @brief Creates the colormap texture unit of a material
+		 * @param const Ogre::MaterialPtr& Material
+		 */
+		void createColormapUnit(const Ogre::MaterialPtr& material);
+
+		/** @brief Sets the colormap texture, and the mapping of the cost range,
+		 * of the column and surface materials */
+		void updateColormap();
+
+		/**
+		 * @brief Indicates if the vertex buffer of a mesh was built, so the
+		 * dirty vertexs are rewritten in place
+		 * @param Ogre::ManualObject* Mesh
+		 * @param unsigned int Number of vertexs of the mesh
+		 * @return True if the dirty vertexs can be rewritten
+		 */
+		bool hasVertexBuffer(Ogre::ManualObject* object,
+							 unsigned int num_vertexs);
+
+		/**
+		 * @brief Gets the vertexs of the column of a cell, which collapse to a
+		 * point when the cell isn't used
+		 * @param const Column& Column of the cell
+		 * @param bool Indicates if the cell is used
+		 * @param float Half of the size of the cell
+		 * @param Ogre::Vector3* 4 bottom and 4 top vertex positions
+		 * @param Ogre::ColourValue* Shading colors of the vertexs
+		 * @param float& Cost of the column
+		 * @return True if the cell is used
+		 */
+		bool getColumnVertexs(const Column& column,
+							  bool used,
+							  float half_size,
+							  Ogre::Vector3* positions,
+							  Ogre::ColourValue* colours,
+							  float& cost);
+
+		/**
+		 * @brief Gets a surface vertex of a tile at its level, where the last
+		 * row and column of vertexs are the cells of the next tiles, so the
+		 * surface has no seams between tiles of the same level
+		 * @param const TerrainTile& Tile
+		 * @param unsigned int Vertex index in the tile
+		 * @param Ogre::Vector3& Position of the vertex
+		 * @param Ogre::Vector3& Normal of the vertex
+		 * @param float& Cost of the vertex
+		 * @return True if the vertex has a cell
+		 */
+		bool getSurfaceVertex(const TerrainTile& tile,
+							  unsigned int vertex,
+							  Ogre::Vector3& position,
+							  Ogre::Vector3& normal,
+							  float& cost);
+
+		/**
+		 * @brief Gets the vertexs of the normal line of a cell, which starts at
+		 * the center of its top voxel and collapses to a point when the cell
+		 * isn't used or isn't a stride-th cell
+		 * @param const TerrainTile& Tile
+		 * @param unsigned int Cell index in the tile
+		 * @param unsigned int Stride of the drawn normals
+		 * @param float Length of the normals
+		 * @param Ogre::Vector3* Positions of the line vertexs
+		 * @return True if the line isn't collapsed
+		 */
+		bool getNormalVertexs(const TerrainTile& tile,
+							  unsigned int cell,
+							  unsigned int stride,
+							  float length,
+							  Ogre::Vector3* positions);
+
+		/**
+		 * @brief Draws the columns of a tile as a mesh with 8 vertexs per cell
+		 * @param TerrainTile& Tile
+		 */
+		void drawColumns(TerrainTile& tile);
+
+		/**
+		 * @brief Rewrites the columns of the dirty cells of a tile
+		 * @param TerrainTile& Tile
+		 */
+		void writeColumns(TerrainTile& tile);
+
+		/**
+		 * @brief Draws the top of the columns of a tile as a heightfield mesh
+		 * with a vertex per cell
+		 * @param TerrainTile& Tile
+		 */
+		void drawSurface(TerrainTile& tile);
+
+		/**
+		 * @brief Rewrites the dirty surface vertexs of a tile
+		 * @param TerrainTile& Tile
+		 */
+		void writeSurface(TerrainTile& tile);
+
+		/**
+		 * @brief Draws every stride-th surface normal of a tile as a line of a
+		 * line list
+		 * @param TerrainTile& Tile
+		 */
+		void drawNormals(TerrainTile& tile);
 
 		/**
-		 * @brief Sets the color of the reward value
-		 * @param double Cost value of the cell
-		 * @param double Maximum cost value of the map
-		 * @param double Minimum cost value of the map
-		 * @param double color_factor Color factor
-		 * @param rviz::PointCloud::Point& point Point with color information
+		 * @brief Rewrites the normal lines of the dirty cells of a tile
+		 * @param TerrainTile& Tile
 		 */
-		void setColor(double cost_value,
-					  double max_cost, double min_cost,
-					  double color_factor, rviz::PointCloud::Point& point);
+		void writeNormals(TerrainTile& tile);
 
 		/** Clears the display data */
 		void clear();
 
 		/** @brief Vector of points */
 		typedef std::vector<rviz::PointCloud::Point> VPoint;
-		typedef std::vector<Normal> VNormal;
+		typedef std::vector<Column> VColumn;
+		typedef boost::unordered_map<uint32_t, unsigned int> TileMap;
 
 		/** @brief Subscriber to the ObstacleMap messages */
-		boost::shared_ptr<message_filters::Subscriber<terrain_server::TerrainMap> > sub_;
+		boost::shared_ptr<message_filters::Subscriber<TerrainMapStream> > sub_;
 
-		/** @brief Mutex of thread */
+		/** @brief Queue of the received messages, which are decoded by its
+		 * worker thread */
+		MessageQueue<TerrainMapStream> queue_;
+
+		/** @brief Queued bytes and dropped messages of the status, which is
+		 * shown again when they change */
+		size_t status_queued_bytes_;
+		unsigned int status_dropped_;
+
+		/** @brief Mutex of the decoded state, which is taken by the worker
+		 * thread but never by the render thread */
 		boost::mutex mutex_;
 
-		/** @brief Ogre-rviz point clouds */
-		rviz::PointCloud* cloud_;
+		/** @brief Last published frame, which is swapped atomically */
+		boost::shared_ptr<TerrainMapFrame> frame_;
+
+		/** @brief Generation of the display, which drops the decoded state and
+		 * the frames of the previous generations */
+		boost::atomic<unsigned int> generation_;
+
+		/** @brief Materials of the columns, which are unlit, of the surface,
+		 * which is lit, and of the normal lines */
+		Ogre::MaterialPtr column_material_;
+		Ogre::MaterialPtr surface_material_;
+		Ogre::MaterialPtr normal_material_;
 
 		/** @brief Properties to show on side panel */
 		rviz::Property* cost_category_;
 		rviz::Property* normal_category_;
+		rviz::Property* snapshot_category_;
 
 		/** @brief Property objects for user-editable properties */
 		rviz::IntProperty* queue_size_property_;
+		rviz::IntProperty* queue_budget_property_;
 		rviz::RosTopicProperty* topic_property_;
+		rviz::EnumProperty* render_mode_property_;
+		rviz::FloatProperty* lod_size_property_;
+		rviz::BoolProperty* rolling_window_property_;
+		rviz::BoolProperty* accumulate_property_;
+		rviz::IntProperty* memory_budget_property_;
+		rviz::StringProperty* snapshot_file_property_;
+		rviz::BoolProperty* save_snapshot_property_;
+		rviz::BoolProperty* load_snapshot_property_;
 		rviz::EnumProperty* voxel_color_property_;
 		rviz::BoolProperty* normal_enable_property_;
 		rviz::ColorProperty* normal_color_property_;
 		rviz::FloatProperty* normal_alpha_property_;
-		rviz::FloatProperty* normal_head_radius_property_;
-		rviz::FloatProperty* normal_head_length_property_;
-		rviz::FloatProperty* normal_shaft_radius_property_;
-		rviz::FloatProperty* normal_shaft_length_property_;
+		rviz::FloatProperty* normal_length_property_;
+		rviz::IntProperty* normal_stride_property_;
 
 		/** @brief Max tree areas */
 		int max_tree_areas_;
 
-		/** @brief New points */
-		VPoint new_points_;
+		/** @brief Colormap of the color mode, which colors the voxels */
+		Colormap colormap_;
+
+		/** @brief Colormap texture of each color mode. The meshes have the cost
+		 * as texture coordinate, so the color mode and the cost range are a
+		 * change of texture and texture transform */
+		std::vector<Ogre::TexturePtr> colormap_textures_;
+
+		/** @brief Indicates if the colormap of the materials has to be updated */
+		bool colormap_changed_;
 
-		/** @brief Point buffer */
-		VPoint point_buf_;
+		/** @brief Information of the drawn map */
+		TerrainMapInfo map_info_;
 
-		/** @brief Array of normal vectors */
-		VNormal normal_buf_;
+		/** @brief Compact cell and cell flag of each slot of the meshes, which
+		 * are copied from the dirty slots of the frames */
+		std::vector<CompactCell> cells_;
+		std::vector<char> used_;
 
-		/** @brief Array of surface normals */
-		std::vector<boost::shared_ptr<ArrowVisual> > arrow_cloud_;
+		/** @brief Tiles of the meshes, and the index of each tile with cells */
+		std::vector<boost::shared_ptr<TerrainTile> > tiles_;
+		TileMap tile_indexes_;
 
-		/** @brief Indicates if the new points was received */
-		bool new_points_received_;
+		/** @brief Indicates if some tile has to be updated */
+		bool redraw_;
+
+		/** @brief Indicates if the transform of the map has to be set */
+		bool transform_pending_;
+
+		/** @brief Render mode of the meshes */
+		TerrainRenderMode render_mode_;
+
+		/** @brief Tile of each tile key. The slots of a tile are contiguous
+		 * and a cell has a fixed slot in its tile, so a cell keeps its place
+		 * in the buffers while its tile is in the map */
+		TileMap tile_map_;
+		std::vector<TerrainCellSlot> slots_;
+
+		/** @brief Key and number of cells of each tile */
+		std::vector<uint32_t> tile_keys_;
+		std::vector<unsigned int> tile_cells_;
+
+		/** @brief Tiles without cells, which are taken by the new tiles */
+		std::vector<unsigned int> free_tiles_;
+
+		/** @brief Slots that have changed since the last frame taken by the
+		 * render thread */
+		std::vector<unsigned int> dirty_slots_;
+
+		/** @brief Tile of each decoded cell, and dirty slots and freed tiles
+		 * of each decoding thread */
+		std::vector<unsigned int> cell_tiles_;
+		std::vector<std::vector<unsigned int> > thread_dirty_slots_;
+		std::vector<std::vector<unsigned int> > thread_free_tiles_;
+
+		/** @brief Number of the decoded messages */
+		unsigned int slot_stamp_;
+
+		/** @brief Indicates if all the buffers have to be built again */
+		bool full_rewrite_;
+
+		/** @brief Generation of the decoded state */
+		unsigned int decode_generation_;
+
+		/** @brief Indicates if the rolling window mode is enabled, which is
+		 * set by the GUI thread and read when the decoded state is dropped */
+		boost::atomic<bool> rolling_window_;
+
+		/** @brief Indicates if the tiles are addressed as a ring of the tiles
+		 * of the window, and the size of the ring in tiles */
+		bool ring_tiles_;
+		unsigned int ring_x_;
+		unsigned int ring_y_;
+
+		/** @brief Indicates if the accumulate mode is enabled, and its memory
+		 * budget in megabytes, which are set by the GUI thread */
+		boost::atomic<bool> accumulate_;
+		boost::atomic<unsigned int> memory_budget_;
+
+		/** @brief Indicates if the cells are accumulated, i.e. the cells that
+		 * aren't in a message are kept until their tile is evicted */
+		bool accumulate_tiles_;
+
+		/** @brief Number of the last message that had cells of each tile, and
+		 * number of evicted tiles */
+		std::vector<unsigned int> tile_stamps_;
+		unsigned int num_evicted_;
 
 		/** @brief Queue size */
 		u_int32_t queue_size_;
@@ -155,36 +811,54 @@ class TerrainMapDisplay : public rviz::Display
 		/** @brief Number of received messages */
 		uint32_t messages_received_;
 
-		/** @brief Color factor */
-		double color_factor_;
-
 		/** @brief Grid size */
 		double grid_size_;
 
 		/** @brief Height size */
 		double height_size_;
 
+		/** @brief Coordinates of the zero keys, the coordinate of a key is
+		 * origin + key * size */
+		double plane_origin_;
+		double height_origin_;
+
 
 	private Q_SLOTS:
 		/** @brief Updates queue size */
 		void updateQueueSize();
 
+		/** @brief Updates the byte budget of the queue */
+		void updateQueueBudget();
+
 		/** @brief Updates the topic name */
 		void updateTopic();
 
+		/** @brief Updates the render mode */
+		void updateRenderMode();
+
+		/** @brief Updates the level of detail */
+		void updateLevelOfDetail();
+
+		/** @brief Updates the rolling window mode */
+		void updateRollingWindow();
+
+		/** @brief Updates the accumulate mode and its memory budget */
+		void updateAccumulate();
+		void updateMemoryBudget();
+
+		/** @brief Saves or loads a snapshot of the map */
+		void updateSnapshot();
+
 		/** @brief Updates surface normal properties */
 		void updateColorMode();
 		void updateNormalStatus();
 		void updateNormalArrowGeometry();
+		void updateNormalLines();
 
 
 	private:
-		/** @brief Current position and orientation */
-		Ogre::Vector3 position_;
-		Ogre::Quaternion orientation_;
-
-		/** @brief Current terrain message */
-		terrain_server::TerrainMapConstPtr terrain_msg_;
+		/** @brief Header of the last terrain message */
+		std_msgs::Header header_;
 
 		/** @brief Terrain minimum and maximum values */
 		double max_cost_;
@@ -2,9 +2,13 @@
 #define DWL_RVIZ_PLUGIN__WHOLE_BODY_TRAJECTORY_DISPLAY__H
 
 #include <rviz/message_filter_display.h>
+#include <OgreMaterial.h>
+#include <OgreQuaternion.h>
 #include <dwl_rviz_plugin/PointVisual.h>
+#include <dwl_rviz_plugin/KdTree.h>
 #include <dwl/utils/RigidBodyDynamics.h>
 #include <dwl_msgs/WholeBodyTrajectory.h>
+#include <geometry_msgs/PointStamped.h>
 
 
 namespace Ogre
@@ -19,6 +23,8 @@ class ColorProperty;
 class FloatProperty;
 class IntProperty;
 class EnumProperty;
+class StringProperty;
+class RosTopicProperty;
 class BillboardLine;
 class VectorProperty;
 class Axes;
@@ -29,6 +35,20 @@ class Axes;
 namespace dwl_rviz_plugin
 {
 
+/** @brief Base or end-effector sample of a trajectory in the pick index */
+struct TrajectorySample
+{
+	TrajectorySample(unsigned int _msg,
+					 unsigned int _state,
+					 int _contact) : msg(_msg), state(_state), contact(_contact) {}
+
+	/** @brief Index of the message, the state and the end-effector (-1 for
+	 * the base) */
+	unsigned int msg;
+	unsigned int state;
+	int contact;
+};
+
 /**
  * @class WholeBodyTrajectoryDisplay
  * @brief Displays a dwl_msgs::WholeBodyTrajectory message
@@ -50,6 +70,12 @@ class WholeBodyTrajectoryDisplay :
 		/** @brief Overridden from Display. */
 		void onInitialize();
 
+		/** @brief Subscribes to the trajectory and the clicked points */
+		void onEnable();
+
+		/** @brief Unsubscribes to the trajectory and the clicked points */
+		void onDisable();
+
 		/** @brief Called when the fixed frame changed */
 		void fixedFrameChanged();
 
@@ -68,6 +94,10 @@ class WholeBodyTrajectoryDisplay :
 		void updateBaseLineProperties();
 		void updateContactStyle();
 		void updateContactLineProperties();
+		void updateAppendMode();
+		void updateHistoryDepth();
+		void updateHistoryColorAndAlpha();
+		void updatePickTopic();
 
 
 	private:
@@ -75,9 +105,67 @@ class WholeBodyTrajectoryDisplay :
 		void processBaseTrajectory();
 		void processContactTrajectory();
 
+		/**
+		 * @brief Gets the base position and RPY angles of a whole-body state
+		 * @param Ogre::Vector3& Base position
+		 * @param Eigen::Vector3d& Base RPY angles
+		 * @param const dwl_msgs::WholeBodyState& Whole-body state
+		 */
+		void getBasePose(Ogre::Vector3& position,
+						 Eigen::Vector3d& rpy,
+						 const dwl_msgs::WholeBodyState& state);
+
+		/** @brief Builds the spatial index of the displayed base and
+		 * end-effector samples. It's built on the first pick after the
+		 * displayed trajectories changed, so the appended chunks aren't indexed
+		 * again by each chunk */
+		void buildPickIndex();
+
+		/**
+		 * @brief Shows the sample that is nearest to a clicked point
+		 * @param const geometry_msgs::PointStamped::ConstPtr& Clicked point
+		 */
+		void processPick(const geometry_msgs::PointStamped::ConstPtr& msg);
+
+		/**
+		 * @brief Checks if a trajectory chunk starts a new planning episode
+		 * @param const dwl_msgs::WholeBodyTrajectory::ConstPtr& Whole-body trajectory msg
+		 * @return True if the chunk doesn't continue the current episode
+		 */
+		bool isNewEpisode(const dwl_msgs::WholeBodyTrajectory::ConstPtr& msg);
+
+		/**
+		 * @brief Decodes a trajectory chunk and appends it to the episode buffers
+		 * @param const dwl_msgs::WholeBodyTrajectory::ConstPtr& Whole-body trajectory msg
+		 */
+		void appendTrajectory(const dwl_msgs::WholeBodyTrajectory::ConstPtr& msg);
+
+		/** @brief Decodes again all the chunks of the episode */
+		void rebuildAppendedTrajectory();
+
+		/**
+		 * @brief Draws the appended points from a given index
+		 * An index equals to zero redraws the whole episode.
+		 * @param uint32_t Index of the first new base point
+		 * @param const std::vector<uint32_t>& Index of the first new point per end-effector
+		 */
+		void drawAppendedBase(uint32_t first);
+		void drawAppendedContacts(const std::vector<uint32_t>& first);
+
 		/** Destroy all the objects for visualization */
 		void destroyObjects();
 
+		/**
+		 * @brief Writes a trajectory into the oldest slot of the history ring
+		 * The slot's vertex buffer is reused in place, so no allocation happens
+		 * once every slot has been filled.
+		 * @param const dwl_msgs::WholeBodyTrajectory::ConstPtr& Whole-body trajectory msg
+		 */
+		void pushHistory(const dwl_msgs::WholeBodyTrajectory::ConstPtr& msg);
+
+		/** @brief Destroys the history ring and its materials */
+		void destroyHistory();
+
 		/** @brief Whole-body trajectory message */
 		dwl_msgs::WholeBodyTrajectory::ConstPtr msg_;
 
@@ -87,6 +175,8 @@ class WholeBodyTrajectoryDisplay :
 		/** @brief Properties to show on side panel */
 		rviz::Property* base_category_;
 		rviz::Property* contact_category_;
+		rviz::Property* history_category_;
+		rviz::Property* pick_category_;
 
 		/** @brief Object for visualization of the data */
 		boost::shared_ptr<Ogre::ManualObject> base_manual_object_;
@@ -97,7 +187,50 @@ class WholeBodyTrajectoryDisplay :
 		std::vector<boost::shared_ptr<rviz::BillboardLine> > contact_billboard_line_;
 		std::vector<std::vector<boost::shared_ptr<PointVisual> > > contact_points_;
 
+		/** @brief Ring of ghost trajectories, one line-list buffer per slot */
+		std::vector<boost::shared_ptr<Ogre::ManualObject> > history_objects_;
+		std::vector<Ogre::MaterialPtr> history_materials_;
+
+		/** @brief Last point of each end-effector while filling a slot */
+		std::vector<std::pair<std::string, Ogre::Vector3> > history_contacts_;
+
+		/** @brief Next slot to overwrite and number of filled slots */
+		unsigned int history_head_;
+		unsigned int history_size_;
+
+		/** @brief Maximum number of vertices per slot */
+		unsigned int history_max_samples_;
+
+		/** @brief Chunks of the current planning episode (append modes) */
+		std::vector<dwl_msgs::WholeBodyTrajectory::ConstPtr> append_msgs_;
+		ros::Time append_stamp_;
+		double append_time_;
+
+		/** @brief Decoded base and end-effector points of the episode */
+		std::vector<Ogre::Vector3> append_base_pos_;
+		std::vector<Ogre::Quaternion> append_base_orientation_;
+		std::map<std::string, uint32_t> append_contact_id_;
+		std::vector<std::vector<Ogre::Vector3> > append_contact_pos_;
+
+		/** @brief Allocated vertices of the episode lines, which grow geometrically */
+		uint32_t append_base_capacity_;
+		std::vector<uint32_t> append_contact_capacity_;
+
+		/** @brief Spatial index of the displayed samples, in the fixed frame */
+		KdTree pick_index_;
+		std::vector<TrajectorySample> pick_samples_;
+		std::vector<dwl_msgs::WholeBodyTrajectory::ConstPtr> pick_msgs_;
+
+		/** @brief Indicates if the displayed samples changed since the index
+		 * was built */
+		bool pick_index_dirty_;
+
+		/** @brief Subscriber to the clicked points */
+		ros::Subscriber pick_sub_;
+
 		/** @brief Property objects for user-editable properties */
+		rviz::EnumProperty* update_mode_property_;
+
 		rviz::EnumProperty* base_style_property_;
 		rviz::ColorProperty* base_color_property_;
 		rviz::FloatProperty* base_alpha_property_;
@@ -109,9 +242,22 @@ class WholeBodyTrajectoryDisplay :
 		rviz::FloatProperty* contact_alpha_property_;
 		rviz::FloatProperty* contact_line_width_property_;
 
+		rviz::IntProperty* history_depth_property_;
+		rviz::IntProperty* history_max_samples_property_;
+		rviz::ColorProperty* history_color_property_;
+		rviz::FloatProperty* history_alpha_property_;
+
+		rviz::RosTopicProperty* pick_topic_property_;
+		rviz::FloatProperty* pick_radius_property_;
+		rviz::FloatProperty* pick_time_property_;
+		rviz::VectorProperty* pick_base_position_property_;
+		rviz::VectorProperty* pick_base_rpy_property_;
+		rviz::StringProperty* pick_contacts_property_;
+
 		Ogre::Vector3 last_point_position_;
 
 		enum LineStyle {LINES, BILLBOARDS, POINTS};
+		enum UpdateMode {REPLACE, APPEND_STAMP, APPEND_TIME};
 };
 
 } //@namespace dwl_rviz_plugin
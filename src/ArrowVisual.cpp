@@ -57,6 +57,12 @@ void ArrowVisual::setFrameOrientation(const Ogre::Quaternion& orientation)
 }
 
 
+void ArrowVisual::setVisible(bool visible)
+{
+	frame_node_->setVisible(visible);
+}
+
+
 void ArrowVisual::setColor(float r, float g, float b, float a)
 {
 	arrow_->setColor(r, g, b, a);
@@ -0,0 +1,215 @@
+#include <dwl_rviz_plugin/Colormap.h>
+
+#include <algorithm>
+
+
+namespace dwl_rviz_plugin
+{
+
+/** @brief Number of values that are normalized in a block */
+static const unsigned int block_size = 1024;
+
+/**
+ * @brief Polynomial fits of the matplotlib perceptual colormaps, i.e.
+ * c0 + c1 t + ... + c6 t^6 for each channel. They are the public-domain
+ * fits of Matt Zucconi.
+ */
+static const float viridis_coeffs[7][3] = {
+		{0.2777273272234177, 0.005407344544966578, 0.3340998053353061},
+		{0.1050930431085774, 1.404613529898575, 1.384590162594685},
+		{-0.3308618287255563, 0.214847559468213, 0.09509516302823659},
+		{-4.634230498983486, -5.799100973351585, -19.33244095627987},
+		{6.228269936347081, 14.17993336680509, 56.69055260068105},
+		{4.776384997670288, -13.74514537774601, -65.35303263337234},
+		{-5.435455855934631, 4.645852612178535, 26.3124352495832}};
+
+static const float magma_coeffs[7][3] = {
+		{-0.002136485053939582, -0.000749655052795221, -0.005386127855323933},
+		{0.2516605407371642, 0.6775232436837668, 2.494026599312351},
+		{8.353717279216625, -3.577719514958484, 0.3144679030132573},
+		{-27.66873308576866, 14.26473078096533, -13.64921318813922},
+		{52.17613981234068, -27.94360607168351, 12.94416944238394},
+		{-50.76852536473588, 29.04658282127291, 4.23415299384598},
+		{18.65570506591883, -11.48977351997711, -5.601961508734096}};
+
+static const float inferno_coeffs[7][3] = {
+		{0.0002189403691192265, 0.001651004631001012, -0.01948089843709184},
+		{0.1065134194856116, 0.5639564367884091, 3.932712388889277},
+		{11.60249308247187, -3.972853965665698, -15.9423941062914},
+		{-41.70399613139459, 17.43639888205313, 44.35414519872813},
+		{77.162935699427, -33.40235894210092, -81.80730925738993},
+		{-71.31942824499214, 32.62606426397723, 73.20951985803202},
+		{25.13112622477341, -12.24266895238567, -23.07032500287172}};
+
+static const float plasma_coeffs[7][3] = {
+		{0.05873234392399702, 0.02333670892565664, 0.5433401826748754},
+		{2.176514634195958, 0.2383834171260182, 0.7539604599784036},
+		{-2.689460476458034, -7.455851135738909, 3.110799939717086},
+		{6.130348345893603, 42.3461881477227, -28.51885465332158},
+		{-11.10743619062271, -82.66631109428045, 60.13984767418263},
+		{10.02306557647065, 71.41361770095349, -54.07218655560067},
+		{-3.658713842777788, -22.93153465461149, 18.19190778539828}};
+
+
+const unsigned int Colormap::size;
+
+
+Colormap::Colormap() : type_(FULL_COLOR), min_value_(0.), scale_(size - 1)
+{
+	setType(type_);
+}
+
+
+Colormap::~Colormap()
+{
+
+}
+
+
+void Colormap::setType(ColormapType type)
+{
+	type_ = type;
+	colors_.resize(size);
+	packed_colors_.resize(size);
+	for (unsigned int i = 0; i < size; i++) {
+		colors_[i] = computeColor(type_, (float) i / (size - 1));
+		packed_colors_[i] = colors_[i].getAsRGBA();
+	}
+}
+
+
+ColormapType Colormap::getType() const
+{
+	return type_;
+}
+
+
+void Colormap::setRange(float min_value, float max_value)
+{
+	// An empty range maps all the values to the first color
+	min_value_ = min_value;
+	if (max_value > min_value)
+		scale_ = (size - 1) / (max_value - min_value);
+	else
+		scale_ = 0.;
+}
+
+
+const Ogre::ColourValue& Colormap::getColor(float value) const
+{
+	float index = (value - min_value_) * scale_ + 0.5;
+	index = std::min(std::max(index, 0.f), size - 1.f);
+	return colors_[(unsigned int) index];
+}
+
+
+void Colormap::getColors(Ogre::ColourValue* colors,
+						 size_t stride,
+						 const float* values,
+						 unsigned int num_values) const
+{
+	unsigned int indexes[block_size];
+	char* color = reinterpret_cast<char*>(colors);
+	for (unsigned int begin = 0; begin < num_values; begin += block_size) {
+		unsigned int num_block = std::min(block_size, num_values - begin);
+		getIndexes(indexes, values + begin, num_block);
+		for (unsigned int i = 0; i < num_block; i++, color += stride)
+			*reinterpret_cast<Ogre::ColourValue*>(color) = colors_[indexes[i]];
+	}
+}
+
+
+void Colormap::getColors(Ogre::RGBA* colors,
+						 const float* values,
+						 unsigned int num_values) const
+{
+	unsigned int indexes[block_size];
+	for (unsigned int begin = 0; begin < num_values; begin += block_size) {
+		unsigned int num_block = std::min(block_size, num_values - begin);
+		getIndexes(indexes, values + begin, num_block);
+		for (unsigned int i = 0; i < num_block; i++)
+			colors[begin + i] = packed_colors_[indexes[i]];
+	}
+}
+
+
+const std::vector<Ogre::RGBA>& Colormap::getTable() const
+{
+	return packed_colors_;
+}
+
+
+void Colormap::getIndexes(unsigned int* indexes,
+						  const float* values,
+						  unsigned int num_values) const
+{
+	// The loop has no branches and the members are copied to locals, so
+	// the compiler vectorizes the normalization and clamping. The build of
+	// the colormap benchmark reports it with GCC
+	const float min_value = min_value_;
+	const float scale = scale_;
+	const float max_index = size - 1;
+	for (unsigned int i = 0; i < num_values; i++) {
+		float index = (values[i] - min_value) * scale + 0.5f;
+		index = index < 0.f ? 0.f : index;
+		index = index > max_index ? max_index : index;
+		indexes[i] = (int) index;
+	}
+}
+
+
+Ogre::ColourValue Colormap::computeColor(ColormapType type,
+										 float value)
+{
+	const float (*coeffs)[3] = NULL;
+	switch (type)
+	{
+	case FULL_COLOR:
+	{
+		// This a color map method proposed by Paul Bourke. For further details
+		// please read: http://paulbourke.net/texture_colour/colourspace/
+		float r = 1., g = 1., b = 1.;
+		if (value < 0.25) {
+			r = 0.;
+			g = 4 * value;
+		} else if (value < 0.5) {
+			r = 0.;
+			b = 1 + 4 * (0.25 - value);
+		} else if (value < 0.75) {
+			r = 4 * (value - 0.5);
+			b = 0.;
+		} else {
+			g = 1 + 4 * (0.75 - value);
+			b = 0.;
+		}
+		return Ogre::ColourValue(r, g, b);
+	} case GREY:
+		return Ogre::ColourValue(1 - value, 1 - value, 1 - value);
+	case VIRIDIS:
+		coeffs = viridis_coeffs;
+		break;
+	case MAGMA:
+		coeffs = magma_coeffs;
+		break;
+	case INFERNO:
+		coeffs = inferno_coeffs;
+		break;
+	case PLASMA:
+		coeffs = plasma_coeffs;
+		break;
+	default:
+		return Ogre::ColourValue::White;
+	}
+
+	// Evaluating the polynomial fit by Horner's method
+	float rgb[3];
+	for (unsigned int c = 0; c < 3; c++) {
+		float v = coeffs[6][c];
+		for (int k = 5; k >= 0; k--)
+			v = v * value + coeffs[k][c];
+		rgb[c] = std::min(std::max(v, 0.f), 1.f);
+	}
+	return Ogre::ColourValue(rgb[0], rgb[1], rgb[2]);
+}
+
+} //@namespace dwl_rviz_plugin
@@ -0,0 +1,75 @@
+#include <dwl_rviz_plugin/Colormap.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+
+using namespace dwl_rviz_plugin;
+
+/** @brief Number of costs of the benchmark, and number of repetitions */
+static const unsigned int num_costs = 1000000;
+static const unsigned int num_repetitions = 20;
+
+/**
+ * @brief Prints the mean time of a benchmark
+ * @param const char* Name of the benchmark
+ * @param const std::chrono::steady_clock::time_point& Start time
+ */
+static void printTime(const char* name,
+					  const std::chrono::steady_clock::time_point& start)
+{
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double milliseconds = 1e3 * seconds / num_repetitions;
+	printf("%-24s %8.3f ms %8.3f ns/cost\n", name, milliseconds,
+		   1e6 * milliseconds / num_costs);
+}
+
+
+/**
+ * @brief Maps 1M costs to colors with the batched paths of the colormap, which
+ * normalize the costs by the vectorized loop, and with a lookup per cost
+ */
+int main(int argc, char** argv)
+{
+	// The costs are out of the range as well, so the clamping is measured
+	std::vector<float> costs(num_costs);
+	srand(0);
+	for (unsigned int i = 0; i < num_costs; i++)
+		costs[i] = 1.2f * rand() / RAND_MAX - 0.1f;
+
+	Colormap colormap;
+	colormap.setType(VIRIDIS);
+	colormap.setRange(0.f, 1.f);
+
+	std::vector<Ogre::ColourValue> colors(num_costs);
+	std::vector<Ogre::RGBA> packed_colors(num_costs);
+	unsigned int checksum = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned int r = 0; r < num_repetitions; r++) {
+		for (unsigned int i = 0; i < num_costs; i++)
+			colors[i] = colormap.getColor(costs[i]);
+		checksum += colors[r].getAsRGBA();
+	}
+	printTime("getColor", start);
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned int r = 0; r < num_repetitions; r++) {
+		colormap.getColors(&colors.front(), sizeof(Ogre::ColourValue),
+						   &costs.front(), num_costs);
+		checksum += colors[r].getAsRGBA();
+	}
+	printTime("getColors (colours)", start);
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned int r = 0; r < num_repetitions; r++) {
+		colormap.getColors(&packed_colors.front(), &costs.front(), num_costs);
+		checksum += packed_colors[r];
+	}
+	printTime("getColors (packed)", start);
+
+	// The checksum keeps the results alive
+	printf("checksum %u\n", checksum);
+	return 0;
+}
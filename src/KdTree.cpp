@@ -0,0 +1,126 @@
+#include <dwl_rviz_plugin/KdTree.h>
+
+#include <algorithm>
+#include <limits>
+
+
+namespace dwl_rviz_plugin
+{
+
+/** @brief Compares two point ids by one of the coordinates */
+struct AxisCompare
+{
+	AxisCompare(const std::vector<Eigen::Vector3f>& _points,
+				unsigned int _axis) : points(_points), axis(_axis) {}
+
+	bool operator()(unsigned int a, unsigned int b) const {
+		return points[a](axis) < points[b](axis);
+	}
+
+	const std::vector<Eigen::Vector3f>& points;
+	unsigned int axis;
+};
+
+
+KdTree::KdTree()
+{
+
+}
+
+
+KdTree::~KdTree()
+{
+
+}
+
+
+void KdTree::build(const std::vector<Eigen::Vector3f>& points)
+{
+	points_ = points;
+	tree_.resize(points_.size());
+	for (unsigned int i = 0; i < tree_.size(); i++)
+		tree_[i] = i;
+
+	build(0, tree_.size(), 0);
+}
+
+
+void KdTree::clear()
+{
+	points_.clear();
+	tree_.clear();
+}
+
+
+bool KdTree::nearest(unsigned int& id,
+					 float& sq_distance,
+					 const Eigen::Vector3f& query) const
+{
+	if (tree_.empty())
+		return false;
+
+	sq_distance = std::numeric_limits<float>::max();
+	nearest(id, sq_distance, query, 0, tree_.size(), 0);
+	return true;
+}
+
+
+unsigned int KdTree::size() const
+{
+	return points_.size();
+}
+
+
+void KdTree::build(unsigned int begin,
+				   unsigned int end,
+				   unsigned int depth)
+{
+	if (end - begin <= 1)
+		return;
+
+	// Splitting the range by the median of the axis of this depth
+	unsigned int mid = begin + (end - begin) / 2;
+	std::nth_element(tree_.begin() + begin,
+					 tree_.begin() + mid,
+					 tree_.begin() + end,
+					 AxisCompare(points_, depth % 3));
+
+	build(begin, mid, depth + 1);
+	build(mid + 1, end, depth + 1);
+}
+
+
+void KdTree::nearest(unsigned int& id,
+					 float& sq_distance,
+					 const Eigen::Vector3f& query,
+					 unsigned int begin,
+					 unsigned int end,
+					 unsigned int depth) const
+{
+	if (begin >= end)
+		return;
+
+	unsigned int mid = begin + (end - begin) / 2;
+	const Eigen::Vector3f& point = points_[tree_[mid]];
+	float d = (point - query).squaredNorm();
+	if (d < sq_distance) {
+		sq_distance = d;
+		id = tree_[mid];
+	}
+
+	// Visiting first the side of the query, and the other one only if the
+	// splitting plane is closer than the current nearest point
+	unsigned int axis = depth % 3;
+	float delta = query(axis) - point(axis);
+	if (delta < 0.) {
+		nearest(id, sq_distance, query, begin, mid, depth + 1);
+		if (delta * delta < sq_distance)
+			nearest(id, sq_distance, query, mid + 1, end, depth + 1);
+	} else {
+		nearest(id, sq_distance, query, mid + 1, end, depth + 1);
+		if (delta * delta < sq_distance)
+			nearest(id, sq_distance, query, begin, mid, depth + 1);
+	}
+}
+
+} //@namespace dwl_rviz_plugin
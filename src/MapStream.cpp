@@ -0,0 +1,89 @@
+#include <dwl_rviz_plugin/MapStream.h>
+
+#include <cstring>
+#include <cmath>
+
+
+namespace dwl_rviz_plugin
+{
+
+uint16_t packCost(double cost)
+{
+	float value = cost;
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = (bits >> 16) & 0x8000;
+	int exponent = (int) ((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffff;
+	if (exponent <= 0)
+		return sign;
+	if (exponent >= 31)
+		return sign | 0x7bff;
+
+	// Rounding to the nearest half, where a carry of the mantissa increments
+	// the exponent
+	uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000)
+		half++;
+	if ((half & 0x7fff) >= 0x7c00)
+		half = sign | 0x7bff;
+	return half;
+}
+
+
+float unpackCost(uint16_t half)
+{
+	uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1f;
+	uint32_t mantissa = half & 0x3ff;
+	uint32_t bits = sign;
+	if (exponent != 0)
+		bits |= ((exponent - 15 + 127) << 23) | (mantissa << 13);
+
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+
+uint32_t packNormal(double x,
+					double y,
+					double z)
+{
+	double norm = fabs(x) + fabs(y) + fabs(z);
+	if (norm == 0.) {
+		z = 1.;
+		norm = 1.;
+	}
+
+	double u = x / norm;
+	double v = y / norm;
+	if (z < 0.) {
+		double folded_u = (1. - fabs(v)) * (u >= 0. ? 1. : -1.);
+		v = (1. - fabs(u)) * (v >= 0. ? 1. : -1.);
+		u = folded_u;
+	}
+
+	uint32_t packed_u = (uint32_t) ((0.5 * u + 0.5) * 65535. + 0.5);
+	uint32_t packed_v = (uint32_t) ((0.5 * v + 0.5) * 65535. + 0.5);
+	return (packed_u << 16) | packed_v;
+}
+
+
+Ogre::Vector3 unpackNormal(uint32_t normal)
+{
+	float u = (normal >> 16) / 65535.f * 2.f - 1.f;
+	float v = (normal & 0xffff) / 65535.f * 2.f - 1.f;
+	float z = 1.f - fabs(u) - fabs(v);
+	if (z < 0.f) {
+		float folded_u = (1.f - fabs(v)) * (u >= 0.f ? 1.f : -1.f);
+		v = (1.f - fabs(u)) * (v >= 0.f ? 1.f : -1.f);
+		u = folded_u;
+	}
+
+	Ogre::Vector3 unit_normal(u, v, z);
+	unit_normal.normalise();
+	return unit_normal;
+}
+
+} //@namespace dwl_rviz_plugin
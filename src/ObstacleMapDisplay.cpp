@@ -4,6 +4,8 @@
 
 #include <OGRE/OgreSceneNode.h>
 #include <OGRE/OgreSceneManager.h>
+#include <OGRE/OgreManualObject.h>
+#include <OGRE/OgreMaterialManager.h>
 
 #include <rviz/visualization_manager.h>
 #include <rviz/frame_manager.h>
@@ -14,6 +16,7 @@
 #include <dwl/environment/SpaceDiscretization.h>
 
 #include <sstream>
+#include <algorithm>
 
 
 using namespace rviz;
@@ -21,6 +24,52 @@ using namespace rviz;
 namespace dwl_rviz_plugin
 {
 
+/**
+ * @brief Merges the faces of a mask into rectangles by greedy meshing, i.e. a
+ * face grows along u while the next faces have its value, and then along v
+ * while the next rows of faces have its value. The merged faces are cleared,
+ * so the mask is empty at the end
+ * @param std::vector<unsigned int>& Mask of faces, where zero is no face
+ * @param unsigned int Size of the mask along u
+ * @param unsigned int Size of the mask along v
+ * @param std::vector<FaceRect>& Merged faces
+ */
+static void mergeFaces(std::vector<unsigned int>& mask,
+					   unsigned int size_u,
+					   unsigned int size_v,
+					   std::vector<FaceRect>& rects)
+{
+	rects.clear();
+	for (unsigned int v = 0; v < size_v; v++) {
+		unsigned int* row = &mask[v * size_u];
+		for (unsigned int u = 0; u < size_u; u++) {
+			if (row[u] == 0)
+				continue;
+
+			FaceRect rect;
+			rect.u = u;
+			rect.v = v;
+			rect.value = row[u];
+			rect.width = 1;
+			while (u + rect.width < size_u && row[u + rect.width] == rect.value)
+				rect.width++;
+			for (rect.height = 1; v + rect.height < size_v; rect.height++) {
+				const unsigned int* next_row = &mask[(v + rect.height) * size_u + u];
+				if (std::count(next_row, next_row + rect.width, rect.value) != (long) rect.width)
+					break;
+			}
+
+			for (unsigned int i = 0; i < rect.height; i++) {
+				unsigned int* merged_row = &mask[(v + i) * size_u + u];
+				std::fill(merged_row, merged_row + rect.width, 0u);
+			}
+			rects.push_back(rect);
+			u += rect.width - 1;
+		}
+	}
+}
+
+
 ObstacleMapDisplay::ObstacleMapDisplay() : rviz::Display(), messages_received_(0), grid_size_(std::numeric_limits<double>::max())
 {
 	obstaclemap_topic_property_ = new RosTopicProperty( "Topic",
@@ -37,6 +86,21 @@ ObstacleMapDisplay::ObstacleMapDisplay() : rviz::Display(), messages_received_(0
 	                                         this, SLOT( updateQueueSize() ));
 	queue_size_property_->setMin(1);
 
+	queue_budget_property_ = new IntProperty( "Queue Budget",
+	                                          64,
+	                                          "Memory of the received messages that wait for the processing, in "
+	                                          "megabytes. A message supersedes the waiting messages, so they are dropped.",
+	                                          this, SLOT( updateQueueBudget() ));
+	queue_budget_property_->setMin(1);
+
+	render_mode_property_ = new EnumProperty( "Render Mode", "Boxes",
+	                                          "Boxes draws a box per voxel down to the lowest cell, and Mesh "
+	                                          "draws only the exposed faces of the obstacles, where the coplanar "
+	                                          "faces are merged.",
+	                                          this, SLOT( updateRenderMode() ));
+	render_mode_property_->addOption( "Boxes", BOXES );
+	render_mode_property_->addOption( "Mesh", MESH );
+
 	color_property_ = new ColorProperty( "Color", QColor( 0, 0, 0 ),
 										  "The color of the obstacle map.",
 										  this, SLOT( updateColor() ));
@@ -46,39 +110,75 @@ ObstacleMapDisplay::ObstacleMapDisplay() : rviz::Display(), messages_received_(0
 	alpha_property_->setMin( 0.0f );
 	alpha_property_->setMax( 1.0f );
 
+	// The queued bytes of the status can't be queued, so the first update
+	// shows the status
+	status_queued_bytes_ = std::numeric_limits<size_t>::max();
+	status_dropped_ = 0;
+	new_points_received_ = false;
+	transform_pending_ = false;
+	new_grid_size_ = 0.;
+	new_height_size_ = 0.;
+	render_mode_ = BOXES;
+	queue_.setBudget((size_t) queue_budget_property_->getInt() << 20);
+	queue_.setLatestWins(true);
 }
 
 
 ObstacleMapDisplay::~ObstacleMapDisplay()
 {
 	unsubscribe();
+	queue_.stop();
 
 	delete cloud_;
+	mesh_object_.reset();
 
 	if (scene_node_)
 		scene_node_->detachAllObjects();
+
+	if (!mesh_material_.isNull())
+		Ogre::MaterialManager::getSingleton().remove(mesh_material_->getName());
 }
 
 
 void ObstacleMapDisplay::update(float wall_dt, float ros_dt)
 {
+	updateQueueStatus();
+
 	if (new_points_received_) {
 		boost::mutex::scoped_lock lock(mutex_);
+		setStatus(StatusProperty::Ok, "Messages", QString::number(messages_received_) + " reward map messages received");
+
+		// The points are transformed by the header of their message
+		header_ = new_header_;
+		transform_pending_ = true;
+
 		cloud_->clear();
-		cloud_->setDimensions(grid_size_, grid_size_, height_size_);
-		cloud_->addPoints(&new_points_.front(), new_points_.size());
+		cloud_->setDimensions(new_grid_size_, new_grid_size_, new_height_size_);
+		if (!new_points_.empty())
+			cloud_->addPoints(&new_points_.front(), new_points_.size());
+		drawMesh();
 
 		new_points_.clear();
+		new_mesh_.positions.clear();
+		new_mesh_.normals.clear();
 
 		new_points_received_ = false;
 	}
+
+	if (transform_pending_)
+		updateTransform();
 }
 
 
 void ObstacleMapDisplay::reset()
 {
 	clear();
-	messages_received_ = 0;
+	queue_.resetDropped();
+	status_queued_bytes_ = std::numeric_limits<size_t>::max();
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		messages_received_ = 0;
+	}
 	setStatus(StatusProperty::Ok, "Messages", QString("0 reward map messages received"));
 }
 
@@ -94,8 +194,19 @@ void ObstacleMapDisplay::onInitialize()
 	cloud_->setRenderMode(rviz::PointCloud::RM_BOXES);
 	scene_node_->attachObject((Ogre::MovableObject*) cloud_);
 
-	alpha_ = alpha_property_->getFloat();
-	color_ = color_property_->getOgreColor();
+	// The mesh is lit, so its faces are shaded by their normals
+	std::stringstream ss;
+	static int count = 0;
+	ss << "ObstacleMesh" << count++;
+	mesh_material_ = Ogre::MaterialManager::getSingleton().create(ss.str(), "rviz");
+	mesh_material_->setReceiveShadows(false);
+	mesh_object_.reset(scene_manager_->createManualObject());
+	mesh_object_->setDynamic(true);
+	scene_node_->attachObject(mesh_object_.get());
+
+	updateColor();
+
+	queue_.start(boost::bind(&ObstacleMapDisplay::processMessage, this, _1));
 }
 
 
@@ -126,7 +237,7 @@ void ObstacleMapDisplay::subscribe()
 		const std::string& topicStr = obstaclemap_topic_property_->getStdString();
 
 		if (!topicStr.empty()) {
-			sub_.reset(new message_filters::Subscriber<terrain_server::ObstacleMap>());
+			sub_.reset(new message_filters::Subscriber<ObstacleMapStream>());
 
 			sub_->subscribe(threaded_nh_, topicStr, queue_size_);
 			sub_->registerCallback(boost::bind(&ObstacleMapDisplay::incomingMessageCallback, this, _1));
@@ -143,82 +254,271 @@ void ObstacleMapDisplay::unsubscribe()
 	clear();
 
 	try {
-		// reset filters
+		// reset filters, and drop the messages of the topic that wait for the
+		// processing
 		sub_.reset();
+		queue_.clear();
 	} catch (ros::Exception& e) {
 		setStatus(StatusProperty::Error, "Topic", (std::string("Error unsubscribing: ") + e.what()).c_str());
 	}
 }
 
 
-void ObstacleMapDisplay::incomingMessageCallback(const terrain_server::ObstacleMapConstPtr& msg)
+void ObstacleMapDisplay::incomingMessageCallback(const ObstacleMapStream::ConstPtr& msg)
 {
-	++messages_received_;
-	setStatus(StatusProperty::Ok, "Messages", QString::number(messages_received_) + " reward map messages received");
+	// The message only waits in the queue, so the subscriber queue doesn't
+	// keep the messages while a message is processed
+	queue_.push(msg, msg->getSize());
+}
 
-	// Getting tf transform
-	Ogre::Vector3 position;
-	Ogre::Quaternion orientation;
-	if (!context_->getFrameManager()->getTransform(msg->header, position, orientation)) {
-		std::stringstream ss;
-		ss << "Failed to transform from frame [" << msg->header.frame_id << "] to frame ["
-		   << context_->getFrameManager()->getFixedFrame() << "]";
-		this->setStatusStd(StatusProperty::Error, "Message", ss.str());
 
-		return;
-	}
-	scene_node_->setOrientation(orientation);
-	scene_node_->setPosition(position);
+void ObstacleMapDisplay::processMessage(const ObstacleMapStream::ConstPtr& msg)
+{
+	// The status and the transform of the scene node are set by the GUI
+	// thread, when the points are drawn
 
 	// Clearing the old data of the buffers
 	point_buf_.clear();
+	mesh_buf_.positions.clear();
+	mesh_buf_.normals.clear();
 
-	// Computing the minimun key of the height
-	unsigned int min_key_z = std::numeric_limits<unsigned int>::max();
-	for (unsigned int i = 0; i < msg->cell.size(); i++) {
-		if (min_key_z > msg->cell[i].key_z)
-			min_key_z = msg->cell[i].key_z;
-	}
+	// The minimun key of the height was computed while the message was parsed
+	unsigned int min_key_z = msg->min_key_z;
 	grid_size_ = msg->plane_size;
 	height_size_ = msg->height_size;
 
-
-	// Getting cell values and size of the pixel
-	dwl::environment::SpaceDiscretization space_discretization(grid_size_);
-	space_discretization.setEnvironmentResolution(height_size_, false);
-	for (unsigned int i = 0; i < msg->cell.size(); i++) {
-		// Getting cartesian information of the reward map
-		PointCloud::Point new_point;
-		double x, y, z;
-		space_discretization.keyToCoord(x, msg->cell[i].key_x, true);
-		space_discretization.keyToCoord(y, msg->cell[i].key_y, true);
-
-		unsigned int key_z = msg->cell[i].key_z;
-		while (key_z >= min_key_z) {
-			space_discretization.keyToCoord(z, key_z, false);
-			Ogre::Vector3 position(x, y, z);
-			new_point.position = position;
-			new_point.setColor(color_.r, color_.g, color_.b, 0.5);
-			key_z -= 1;
-
-			point_buf_.push_back(new_point);
+	// The mesh mode draws only the exposed faces, instead of a box per voxel
+	if (render_mode_ == MESH)
+		buildMesh(*msg, min_key_z);
+	else {
+		// Getting cell values and size of the pixel
+		dwl::environment::SpaceDiscretization space_discretization(grid_size_);
+		space_discretization.setEnvironmentResolution(height_size_, false);
+		for (unsigned int i = 0; i < msg->key_x.size(); i++) {
+			// Getting cartesian information of the reward map
+			PointCloud::Point new_point;
+			double x, y, z;
+			space_discretization.keyToCoord(x, msg->key_x[i], true);
+			space_discretization.keyToCoord(y, msg->key_y[i], true);
+
+			unsigned int key_z = msg->key_z[i];
+			while (key_z >= min_key_z) {
+				space_discretization.keyToCoord(z, key_z, false);
+				Ogre::Vector3 position(x, y, z);
+				new_point.position = position;
+				new_point.setColor(color_.r, color_.g, color_.b, 0.5);
+				key_z -= 1;
+
+				point_buf_.push_back(new_point);
+			}
 		}
 	}
 
 	// Recording the data from the buffers
 	boost::mutex::scoped_lock lock(mutex_);
 
+	++messages_received_;
+	last_msg_ = msg;
+	new_header_ = msg->header;
+	new_grid_size_ = grid_size_;
+	new_height_size_ = height_size_;
 	new_points_.swap(point_buf_);
+	new_mesh_.positions.swap(mesh_buf_.positions);
+	new_mesh_.normals.swap(mesh_buf_.normals);
 
 	new_points_received_ = true;
 }
 
 
+void ObstacleMapDisplay::buildMesh(const ObstacleMapStream& msg,
+								   unsigned int min_key_z)
+{
+	unsigned int num_cells = msg.key_x.size();
+	if (num_cells == 0)
+		return;
+
+	// Getting the heights of the columns in a grid over the keys of the
+	// cells, in voxels from the lowest key
+	unsigned int min_key_x = *std::min_element(msg.key_x.begin(), msg.key_x.end());
+	unsigned int max_key_x = *std::max_element(msg.key_x.begin(), msg.key_x.end());
+	unsigned int min_key_y = *std::min_element(msg.key_y.begin(), msg.key_y.end());
+	unsigned int max_key_y = *std::max_element(msg.key_y.begin(), msg.key_y.end());
+	unsigned int size_x = max_key_x - min_key_x + 1;
+	unsigned int size_y = max_key_y - min_key_y + 1;
+	std::vector<unsigned int> heights(size_x * size_y, 0);
+	unsigned int max_height = 0;
+	for (unsigned int i = 0; i < num_cells; i++) {
+		unsigned int column = (msg.key_y[i] - min_key_y) * size_x + msg.key_x[i] - min_key_x;
+		unsigned int height = msg.key_z[i] - min_key_z + 1;
+		heights[column] = std::max(heights[column], height);
+		max_height = std::max(max_height, height);
+	}
+
+	// Getting the lowest corner of the columns, where the coordinate of a key
+	// is the center of its voxel
+	dwl::environment::SpaceDiscretization space_discretization(grid_size_);
+	space_discretization.setEnvironmentResolution(height_size_, false);
+	double x, y, z;
+	space_discretization.keyToCoord(x, (unsigned short) min_key_x, true);
+	space_discretization.keyToCoord(y, (unsigned short) min_key_y, true);
+	space_discretization.keyToCoord(z, (unsigned short) min_key_z, false);
+	Ogre::Vector3 corner(x - 0.5 * grid_size_, y - 0.5 * grid_size_, z - 0.5 * height_size_);
+
+	// Adding the top faces, which are merged when they have the same height,
+	// and the bottom faces of all the columns
+	Ogre::Vector3 x_size(grid_size_, 0., 0.);
+	Ogre::Vector3 y_size(0., grid_size_, 0.);
+	Ogre::Vector3 z_size(0., 0., height_size_);
+	std::vector<FaceRect> rects;
+	std::vector<unsigned int> mask(heights);
+	mergeFaces(mask, size_x, size_y, rects);
+	addQuads(rects, corner, x_size, y_size, z_size, Ogre::Vector3::UNIT_Z);
+	for (unsigned int i = 0; i < heights.size(); i++)
+		mask[i] = heights[i] != 0;
+	mergeFaces(mask, size_x, size_y, rects);
+	addQuads(rects, corner, x_size, y_size, Ogre::Vector3::ZERO, Ogre::Vector3::NEGATIVE_UNIT_Z);
+
+	// Adding the side faces across x and y
+	addSideFaces(heights, size_x, size_y, max_height, 0, corner);
+	addSideFaces(heights, size_x, size_y, max_height, 1, corner);
+}
+
+
+void ObstacleMapDisplay::addSideFaces(const std::vector<unsigned int>& heights,
+									  unsigned int size_x,
+									  unsigned int size_y,
+									  unsigned int max_height,
+									  unsigned int axis,
+									  const Ogre::Vector3& corner)
+{
+	// The planes are the boundaries between the columns along the axis, and
+	// the faces of a plane are in a (u, z) mask, where u is the other axis
+	unsigned int num_planes = (axis == 0 ? size_x : size_y) + 1;
+	unsigned int size_u = axis == 0 ? size_y : size_x;
+	Ogre::Vector3 plane_step = axis == 0 ?
+			Ogre::Vector3(grid_size_, 0., 0.) : Ogre::Vector3(0., grid_size_, 0.);
+	Ogre::Vector3 u_size = axis == 0 ?
+			Ogre::Vector3(0., grid_size_, 0.) : Ogre::Vector3(grid_size_, 0., 0.);
+	Ogre::Vector3 v_size(0., 0., height_size_);
+	Ogre::Vector3 normal = axis == 0 ? Ogre::Vector3::UNIT_X : Ogre::Vector3::UNIT_Y;
+
+	// A face is exposed where one column is higher than the other, and it
+	// faces away from the higher column. The masks are cleared by the merge,
+	// so they are reused by the next plane
+	std::vector<unsigned int> front_mask(size_u * max_height, 0);
+	std::vector<unsigned int> back_mask(size_u * max_height, 0);
+	std::vector<FaceRect> rects;
+	for (unsigned int p = 0; p < num_planes; p++) {
+		for (unsigned int u = 0; u < size_u; u++) {
+			unsigned int behind = 0, ahead = 0;
+			if (p > 0)
+				behind = heights[axis == 0 ? u * size_x + p - 1 : (p - 1) * size_x + u];
+			if (p + 1 < num_planes)
+				ahead = heights[axis == 0 ? u * size_x + p : p * size_x + u];
+			for (unsigned int z = ahead; z < behind; z++)
+				front_mask[z * size_u + u] = 1;
+			for (unsigned int z = behind; z < ahead; z++)
+				back_mask[z * size_u + u] = 1;
+		}
+
+		Ogre::Vector3 plane_corner = corner + plane_step * p;
+		mergeFaces(front_mask, size_u, max_height, rects);
+		addQuads(rects, plane_corner, u_size, v_size, Ogre::Vector3::ZERO, normal);
+		mergeFaces(back_mask, size_u, max_height, rects);
+		addQuads(rects, plane_corner, u_size, v_size, Ogre::Vector3::ZERO, -normal);
+	}
+}
+
+
+void ObstacleMapDisplay::addQuads(const std::vector<FaceRect>& rects,
+								  const Ogre::Vector3& corner,
+								  const Ogre::Vector3& u_size,
+								  const Ogre::Vector3& v_size,
+								  const Ogre::Vector3& value_offset,
+								  const Ogre::Vector3& normal)
+{
+	// The vertexs are counter-clockwise seen from the side of the normal, so
+	// the back faces are culled
+	bool counter_clockwise = u_size.crossProduct(v_size).dotProduct(normal) > 0.;
+	for (unsigned int i = 0; i < rects.size(); i++) {
+		const FaceRect& rect = rects[i];
+		Ogre::Vector3 origin = corner + u_size * rect.u + v_size * rect.v + value_offset * rect.value;
+		Ogre::Vector3 u_side = u_size * rect.width;
+		Ogre::Vector3 v_side = v_size * rect.height;
+		mesh_buf_.positions.push_back(origin);
+		mesh_buf_.positions.push_back(origin + (counter_clockwise ? u_side : v_side));
+		mesh_buf_.positions.push_back(origin + u_side + v_side);
+		mesh_buf_.positions.push_back(origin + (counter_clockwise ? v_side : u_side));
+		mesh_buf_.normals.insert(mesh_buf_.normals.end(), 4, normal);
+	}
+}
+
+
+void ObstacleMapDisplay::drawMesh()
+{
+	mesh_object_->clear();
+	unsigned int num_vertexs = new_mesh_.positions.size();
+	if (num_vertexs == 0)
+		return;
+
+	mesh_object_->estimateVertexCount(num_vertexs);
+	mesh_object_->estimateIndexCount(num_vertexs / 4 * 6);
+	mesh_object_->begin(mesh_material_->getName(), Ogre::RenderOperation::OT_TRIANGLE_LIST);
+	for (unsigned int v = 0; v < num_vertexs; v++) {
+		mesh_object_->position(new_mesh_.positions[v]);
+		mesh_object_->normal(new_mesh_.normals[v]);
+	}
+	for (unsigned int v = 0; v < num_vertexs; v += 4)
+		mesh_object_->quad(v, v + 1, v + 2, v + 3);
+	mesh_object_->end();
+}
+
+
+void ObstacleMapDisplay::updateQueueStatus()
+{
+	size_t queued_bytes;
+	unsigned int num_dropped;
+	queue_.getState(queued_bytes, num_dropped);
+	if (queued_bytes == status_queued_bytes_ && num_dropped == status_dropped_)
+		return;
+
+	std::stringstream ss;
+	ss << queued_bytes / 1024 << " KB queued, " << num_dropped << " messages dropped";
+	setStatusStd(StatusProperty::Ok, "Queue", ss.str());
+	status_queued_bytes_ = queued_bytes;
+	status_dropped_ = num_dropped;
+}
+
+
+void ObstacleMapDisplay::updateTransform()
+{
+	// Getting tf transform, which is tried again at the next update when the
+	// frame isn't available yet
+	Ogre::Vector3 position;
+	Ogre::Quaternion orientation;
+	if (!context_->getFrameManager()->getTransform(header_, position, orientation)) {
+		std::stringstream ss;
+		ss << "Failed to transform from frame [" << header_.frame_id << "] to frame ["
+		   << context_->getFrameManager()->getFixedFrame() << "]";
+		this->setStatusStd(StatusProperty::Error, "Message", ss.str());
+
+		return;
+	}
+	scene_node_->setOrientation(orientation);
+	scene_node_->setPosition(position);
+	deleteStatusStd("Message");
+	transform_pending_ = false;
+}
+
+
 void ObstacleMapDisplay::clear()
 {
 	boost::mutex::scoped_lock lock(mutex_);
 
 	cloud_->clear();
+	if (mesh_object_)
+		mesh_object_->clear();
+	last_msg_.reset();
 }
 
 
@@ -230,6 +530,12 @@ void ObstacleMapDisplay::updateQueueSize()
 }
 
 
+void ObstacleMapDisplay::updateQueueBudget()
+{
+	queue_.setBudget((size_t) queue_budget_property_->getInt() << 20);
+}
+
+
 void ObstacleMapDisplay::updateTopic()
 {
 	unsubscribe();
@@ -239,12 +545,35 @@ void ObstacleMapDisplay::updateTopic()
 }
 
 
+void ObstacleMapDisplay::updateRenderMode()
+{
+	render_mode_ = render_mode_property_->getOptionInt();
+
+	// The last message is processed again in the new mode
+	boost::mutex::scoped_lock lock(mutex_);
+	if (last_msg_)
+		queue_.push(last_msg_, last_msg_->getSize());
+}
+
+
 void ObstacleMapDisplay::updateColor()
 {
 //	QColor color = color_property_->getColor();
 	//color.setAlphaF( alpha_property_->getFloat() );
 	alpha_ = alpha_property_->getFloat();
 	color_ = color_property_->getOgreColor();
+
+	if (!mesh_material_.isNull()) {
+		mesh_material_->setAmbient(0.5 * color_.r, 0.5 * color_.g, 0.5 * color_.b);
+		mesh_material_->setDiffuse(color_.r, color_.g, color_.b, alpha_);
+		if (alpha_ < 1.) {
+			mesh_material_->setSceneBlending(Ogre::SBT_TRANSPARENT_ALPHA);
+			mesh_material_->setDepthWriteEnabled(false);
+		} else {
+			mesh_material_->setSceneBlending(Ogre::SBT_REPLACE);
+			mesh_material_->setDepthWriteEnabled(true);
+		}
+	}
 	//context_->queueRender();
 }
 
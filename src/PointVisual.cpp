@@ -58,6 +58,12 @@ void PointVisual::setFrameOrientation(const Ogre::Quaternion& orientation)
 }
 
 
+void PointVisual::setVisible(bool visible)
+{
+	frame_node_->setVisible(visible);
+}
+
+
 void PointVisual::setColor(float r, float g, float b, float a)
 {
 	point_->setColor(r, g, b, a);
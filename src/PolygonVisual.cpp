@@ -102,6 +102,13 @@ void PolygonVisual::setFrameOrientation(const Ogre::Quaternion& orientation)
 }
 
 
+void PolygonVisual::setVisible(bool visible)
+{
+	frame_node_->setVisible(visible);
+	mesh_->getRootNode()->setVisible(visible);
+}
+
+
 void PolygonVisual::setLineColor(float r, float g, float b, float a)
 {
 	unsigned int num_line = line_.size();
@@ -5,11 +5,13 @@
 #include <OgreManualObject.h>
 #include <OgreBillboardSet.h>
 #include <OgreMatrix4.h>
+#include <OgreMaterialManager.h>
 
 #include <tf/transform_listener.h>
 
 #include <rviz/display_context.h>
 #include <rviz/frame_manager.h>
+#include <rviz/properties/bool_property.h>
 #include <rviz/properties/enum_property.h>
 #include <rviz/properties/color_property.h>
 #include <rviz/properties/float_property.h>
@@ -18,6 +20,11 @@
 #include <rviz/validate_floats.h>
 
 #include <rviz/ogre_helpers/billboard_line.h>
+#include <rviz/ogre_helpers/point_cloud.h>
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
 
 
 using namespace rviz;
@@ -26,8 +33,9 @@ namespace dwl_rviz_plugin
 {
 
 ReducedTrajectoryDisplay::ReducedTrajectoryDisplay() : received_msg_(false),
-		new_msg_(false), display_idx_(0), next_(false), mode_display_(REALTIME),
-		rt_factor_(1.)
+		new_msg_(false), shown_idx_(-1), batch_node_(NULL),
+		interp_support_size_(0), mode_display_(REALTIME), rt_factor_(1.),
+		interpolation_(true), queue_policy_(PREEMPT)
 {
 	// Mode display properties
 	mode_display_property_ =
@@ -41,10 +49,37 @@ ReducedTrajectoryDisplay::ReducedTrajectoryDisplay() : received_msg_(false),
 	// Real-time factor properties
 	rt_factor_property_ =
 			new rviz::FloatProperty("RT Factor", 1.0,
-									"0.01 is 1% of speed, 1.0 is real-time speed.",
+									"0.01 is 1% of speed, 1.0 is real-time speed and 10.0 "
+									"is ten times faster.",
 									this, SLOT(updateModeDisplay()), this);
 	rt_factor_property_->setMin(0.01);
-	rt_factor_property_->setMax(1);
+	rt_factor_property_->setMax(10);
+
+	// Interpolation properties
+	interpolation_property_ =
+			new rviz::BoolProperty("Interpolation", true,
+								   "Interpolates the states between the knots of the "
+								   "trajectory in realtime and loop modes.",
+								   this, SLOT(updateModeDisplay()), this);
+
+	// Queue policy properties
+	queue_policy_property_ =
+			new rviz::EnumProperty("Queue Policy", "Preempt",
+								   "Policy for the trajectories that arrive during "
+								   "a playback",
+								   this, SLOT(updateQueuePolicy()), this);
+	queue_policy_property_->addOption("Preempt", PREEMPT);
+	queue_policy_property_->addOption("Finish Then Latest", FINISH_LATEST);
+	queue_policy_property_->addOption("Queue", QUEUE);
+
+	queue_size_property_ =
+			new rviz::IntProperty("Queue Size", 5,
+								  "Number of trajectories that wait for the end of "
+								  "the playback, the oldest one is dropped.",
+								  this, SLOT(updateQueuePolicy()), this);
+	queue_size_property_->setMin(1);
+	queue_size_property_->setMax(100);
+	queue_size_property_->hide();
 
 	// Category Groups
 	com_category_ = new rviz::Property("Center of Mass", QVariant(), "", this);
@@ -119,30 +154,41 @@ ReducedTrajectoryDisplay::ReducedTrajectoryDisplay() : received_msg_(false),
 ReducedTrajectoryDisplay::~ReducedTrajectoryDisplay()
 {
 	destroyObjects();
+	if (batch_node_ != NULL) {
+		Ogre::MaterialManager::getSingleton().remove(support_material_->getName());
+		scene_manager_->destroySceneNode(batch_node_);
+	}
 }
 
 
 void ReducedTrajectoryDisplay::onInitialize()
 {
 	MFDClass::onInitialize();
+	updateQueuePolicy();
+
+	// Scene node of the batched objects, which is in the frame of the message
+	batch_node_ = scene_node_->createChildSceneNode();
+
+	// The support mesh takes the colors from its vertices
+	static int count = 0;
+	std::stringstream ss;
+	ss << "ReducedTrajectorySupport" << count++;
+	support_material_ =
+			Ogre::MaterialManager::getSingleton().create(ss.str(), "rviz");
+	support_material_->setReceiveShadows(false);
+	support_material_->setLightingEnabled(false);
+	support_material_->setSceneBlending(Ogre::SBT_TRANSPARENT_ALPHA);
+	support_material_->setDepthWriteEnabled(false);
+	support_material_->setCullingMode(Ogre::CULL_NONE);
 }
 
 
 void ReducedTrajectoryDisplay::fixedFrameChanged()
 {
 	if (received_msg_) {
-		// Setting up the message
-		new_msg_ = true;
-
-		// Resetting the values for the new message display
-		msg_time_ = msg_->actual.time / rt_factor_;
-		display_idx_ = -1;
-
-		// Destroying the old displays
-		destroyObjects();
-
-		// Compute the set of colors
-		generateSetOfColors(colours_, msg_->trajectory.size());
+		// Only the frame of the precomputed visuals changes
+		updateFrameTransform();
+		context_->queueRender();
 	}
 }
 
@@ -151,6 +197,9 @@ void ReducedTrajectoryDisplay::reset()
 {
 	MFDClass::reset();
 	destroyObjects();
+	queue_msgs_.clear();
+	queue_geometry_.clear();
+	queue_visuals_.clear();
 }
 
 
@@ -164,16 +213,21 @@ void ReducedTrajectoryDisplay::updateModeDisplay()
 	} else
 		rt_factor_property_->hide();
 
+	if (mode_display_ == FULL)
+		interpolation_property_->hide();
+	else
+		interpolation_property_->show();
+	interpolation_ = interpolation_property_->getBool();
+
 	// Updating the display if there is old information
 	if (received_msg_) {
 		// Resetting the values for the new message display
-		msg_time_ = msg_->actual.time / rt_factor_;
-		display_idx_ = -1;
-		next_ = true;
+		msg_time_ = msg_->actual.time;
 		new_msg_ = true;
 
-		// Destroying the old displays
+		// Creating the visuals of the mode display
 		destroyObjects();
+		createObjects();
 
 		// Updating the display
 		updateDisplay();
@@ -186,8 +240,17 @@ void ReducedTrajectoryDisplay::updateCoMRadiusAndAlpha()
 	com_radius_ = com_radius_property_->getFloat();
 	com_alpha_ = com_alpha_property_->getFloat();
 
-	for (size_t i = 0; i < com_visual_.size(); i++)
+	for (size_t i = 0; i < com_visual_.size(); i++) {
+		const Ogre::ColourValue& colour = geometry_->colour[i];
+		com_visual_[i]->setColor(colour.r, colour.g, colour.b, com_alpha_);
 		com_visual_[i]->setRadius(com_radius_);
+	}
+	interpolateState(msg_time_);
+
+	if (full_com_cloud_) {
+		full_com_cloud_->setDimensions(com_radius_, com_radius_, com_radius_);
+		full_com_cloud_->setAlpha(com_alpha_);
+	}
 
 	context_->queueRender();
 }
@@ -198,8 +261,17 @@ void ReducedTrajectoryDisplay::updateCoPRadiusAndAlpha()
 	cop_radius_ = cop_radius_property_->getFloat();
 	cop_alpha_ = cop_alpha_property_->getFloat();
 
-	for (size_t i = 0; i < cop_visual_.size(); i++)
+	for (size_t i = 0; i < cop_visual_.size(); i++) {
+		const Ogre::ColourValue& colour = geometry_->colour[i];
+		cop_visual_[i]->setColor(colour.r, colour.g, colour.b, cop_alpha_);
 		cop_visual_[i]->setRadius(cop_radius_);
+	}
+	interpolateState(msg_time_);
+
+	if (full_cop_cloud_) {
+		full_cop_cloud_->setDimensions(cop_radius_, cop_radius_, cop_radius_);
+		full_cop_cloud_->setAlpha(cop_alpha_);
+	}
 
 	context_->queueRender();
 }
@@ -212,8 +284,13 @@ void ReducedTrajectoryDisplay::updateSupportAlpha()
 
 	float radius = support_line_radius_property_->getFloat();
 	for (unsigned int i = 0; i < support_visual_.size(); i++) {
+		const Ogre::ColourValue& colour = geometry_->colour[i];
+		support_visual_[i]->setLineColor(colour.r, colour.g, colour.b, support_line_alpha_);
 		support_visual_[i]->setLineRadius(radius);
+		support_visual_[i]->setMeshColor(colour.r, colour.g, colour.b, support_mesh_alpha_);
 	}
+	updateFullSupport();
+	interpolateState(msg_time_);
 
 	context_->queueRender();
 }
@@ -223,26 +300,65 @@ void ReducedTrajectoryDisplay::updatePendulumArrowGeometry()
 {
 	pendulum_alpha_ = pendulum_alpha_property_->getFloat();
 
+	float line_radius = pendulum_line_radius_property_->getFloat();
+	for (unsigned int i = 0; i < pendulum_visual_.size(); i++) {
+		const Ogre::ColourValue& colour = geometry_->colour[i];
+		pendulum_visual_[i]->setColor(colour.r, colour.g, colour.b, pendulum_alpha_);
+		pendulum_visual_[i]->setProperties(geometry_->pendulum_length[i], line_radius, 0., 0.);
+	}
+	updateFullPendulum();
+	interpolateState(msg_time_);
+
 	context_->queueRender();
 }
 
 
-void ReducedTrajectoryDisplay::processMessage(const dwl_msgs::ReducedBodyTrajectory::ConstPtr& msg)
+void ReducedTrajectoryDisplay::updateQueuePolicy()
 {
-	// Setting up the message
-	msg_ = msg;
-	received_msg_ = true;
-	new_msg_ = true;
+	queue_policy_ = (QueuePolicy) queue_policy_property_->getOptionInt();
 
-	// Resetting the values for the new message display
-	msg_time_ = msg_->actual.time / rt_factor_;
-	display_idx_ = -1;
+	// Keeping the latest trajectories that fit in the queue
+	unsigned int capacity = 1;
+	if (queue_policy_ == QUEUE) {
+		queue_size_property_->show();
+		capacity = queue_size_property_->getInt();
+	} else
+		queue_size_property_->hide();
+	queue_msgs_.rset_capacity(capacity);
+	queue_geometry_.rset_capacity(capacity);
+	queue_visuals_.rset_capacity(capacity);
+
+	// The preempt policy doesn't wait
+	if (queue_policy_ == PREEMPT && !queue_msgs_.empty())
+		playNextTrajectory();
+}
 
-	// Destroying the old displays
-	destroyObjects();
 
-	// Compute the set of colors
-	generateSetOfColors(colours_, msg_->trajectory.size() + 1);
+void ReducedTrajectoryDisplay::processMessage(const dwl_msgs::ReducedBodyTrajectory::ConstPtr& msg)
+{
+	// Computing the geometry of all the states once when the message arrives,
+	// the playback only changes the visibility of the visuals
+	boost::shared_ptr<ReducedTrajectoryGeometry> geometry(new ReducedTrajectoryGeometry());
+	computeGeometry(*geometry, *msg);
+
+	// The trajectory waits for the end of the playback, where the oldest
+	// queued trajectory is dropped when the queue is full. Note that the full
+	// mode doesn't have a playback
+	if (received_msg_ && queue_policy_ != PREEMPT && mode_display_ != FULL) {
+		// The visuals of the states are built now, so switching to the
+		// trajectory only swaps them in
+		boost::shared_ptr<ReducedTrajectoryVisuals> visuals;
+		if (!interpolation_) {
+			visuals.reset(new ReducedTrajectoryVisuals());
+			createStateVisuals(*visuals, *geometry);
+		}
+		queue_msgs_.push_back(msg);
+		queue_geometry_.push_back(geometry);
+		queue_visuals_.push_back(visuals);
+		return;
+	}
+
+	playTrajectory(msg, geometry, boost::shared_ptr<ReducedTrajectoryVisuals>());
 }
 
 
@@ -250,91 +366,263 @@ void ReducedTrajectoryDisplay::update(float wall_dt, float ros_dt)
 {
 	// Display the state when a new message arrives
 	if (new_msg_) {
-		// Increment the message time
-		msg_time_ += wall_dt;
+		// Increment the message time, the real-time factor is only applied
+		// in loop mode
+		if (mode_display_ == LOOP)
+			msg_time_ += wall_dt * rt_factor_;
+		else
+			msg_time_ += wall_dt;
 
 		// Updating the display
 		updateDisplay();
+	} else if (!queue_msgs_.empty()) {
+		// The playback is finished
+		playNextTrajectory();
 	}
 }
 
 
+void ReducedTrajectoryDisplay::playTrajectory(const dwl_msgs::ReducedBodyTrajectory::ConstPtr& msg,
+											  const boost::shared_ptr<ReducedTrajectoryGeometry>& geometry,
+											  const boost::shared_ptr<ReducedTrajectoryVisuals>& visuals)
+{
+	// Setting up the message
+	msg_ = msg;
+	geometry_ = geometry;
+	received_msg_ = true;
+	new_msg_ = true;
+
+	// Resetting the values for the new message display
+	msg_time_ = msg_->actual.time;
+
+	// Destroying the old displays, and swapping in the visuals that were
+	// built while the trajectory was queued. They are built now when the
+	// mode changed since then
+	destroyObjects();
+	if (visuals && mode_display_ != FULL && !interpolation_) {
+		com_visual_.swap(visuals->com);
+		cop_visual_.swap(visuals->cop);
+		support_visual_.swap(visuals->support);
+		pendulum_visual_.swap(visuals->pendulum);
+		updateObjects();
+	} else
+		createObjects();
+}
+
+
+void ReducedTrajectoryDisplay::playNextTrajectory()
+{
+	dwl_msgs::ReducedBodyTrajectory::ConstPtr msg = queue_msgs_.front();
+	boost::shared_ptr<ReducedTrajectoryGeometry> geometry = queue_geometry_.front();
+	boost::shared_ptr<ReducedTrajectoryVisuals> visuals = queue_visuals_.front();
+	queue_msgs_.pop_front();
+	queue_geometry_.pop_front();
+	queue_visuals_.pop_front();
+
+	playTrajectory(msg, geometry, visuals);
+}
+
+
 void ReducedTrajectoryDisplay::destroyObjects()
 {
 	com_visual_.clear();
 	cop_visual_.clear();
-	for (std::vector<PolygonVisual*>::iterator it = support_visual_.begin();
-			it != support_visual_.end(); ++it)
-		delete (*it);
 	support_visual_.clear();
 	pendulum_visual_.clear();
+	shown_idx_ = -1;
+
+	full_com_cloud_.reset();
+	full_cop_cloud_.reset();
+	full_support_line_.reset();
+	full_pendulum_line_.reset();
+	full_support_mesh_.reset();
+
+	interp_com_visual_.reset();
+	interp_cop_visual_.reset();
+	interp_pendulum_visual_.reset();
+	interp_support_line_.reset();
+	interp_support_mesh_.reset();
+	interp_support_size_ = 0;
 }
 
 
 void ReducedTrajectoryDisplay::updateDisplay()
 {
 	// Visualization of the reduced trajectory
-	dwl_msgs::ReducedBodyState state;
 	if (mode_display_ == FULL) {
-		for (unsigned int k = 0; k < msg_->trajectory.size() + 1; k++) {
-			// Setting up the actual display index
-			display_idx_ = k - 1;
-
-			// Getting the actual state to display
-			if (k == 0)
-				state = msg_->actual;
-			else
-				state = msg_->trajectory[display_idx_];
-
-			// Display the state
-			displayState(state);
-		}
-
-		// No new message to process it
+		// All the states are drawn by the batched objects, so there is
+		// nothing to update
 		new_msg_ = false;
 	} else { // realtime or loop
-		// Getting the actual state to display
-		if (display_idx_ == -1)
-			state = msg_->actual;
-		else
-			state = msg_->trajectory[display_idx_];
-
-		if (next_) {
-			// Destroy all the visual information
-			destroyObjects();
-
-			displayState(state);
-		}
+		const std::vector<double>& time = geometry_->time;
+		double final_time = time.back();
 
 		// Visualization according to the defined mode (realtime / loop)
 		if (mode_display_ == REALTIME) {
-			if (msg_time_ >= state.time) {
-				next_ = true;
-				display_idx_++;
-
-				if (display_idx_ > (int) msg_->trajectory.size() - 1) {
-					display_idx_ = msg_->trajectory.size() - 1;
-					new_msg_ = false;
-				}
-			} else
-				next_ = false;
+			if (msg_time_ >= final_time) {
+				msg_time_ = final_time;
+				new_msg_ = false;
+			}
 		} else { // loop mode
-			if (msg_time_ >= state.time / rt_factor_) {
-				next_ = true;
-				display_idx_++;
-
-				if (display_idx_ > (int) msg_->trajectory.size() - 1) {
-					msg_time_ = msg_->actual.time / rt_factor_;
-					display_idx_ = -1;
-				}
-			} else
-				next_ = false;
+			double duration = final_time - time.front();
+			if (msg_time_ > final_time && !queue_msgs_.empty()) {
+				// The loop finishes when there are queued trajectories
+				msg_time_ = final_time;
+				new_msg_ = false;
+			} else if (msg_time_ > final_time) {
+				if (duration > 0.)
+					msg_time_ = time.front() + fmod(msg_time_ - time.front(), duration);
+				else
+					msg_time_ = time.front();
+			}
+		}
+
+		if (interpolation_)
+			interpolateState(msg_time_);
+		else {
+			// Finding the last state that starts before the message time. Note
+			// that the intermediate states are skipped when the rendering is
+			// slower than the trajectory
+			std::vector<double>::const_iterator it =
+					std::upper_bound(time.begin(), time.end(), msg_time_);
+			unsigned int idx = (it == time.begin()) ? 0 : it - time.begin() - 1;
+			showState(idx);
+		}
+	}
+}
+
+
+void ReducedTrajectoryDisplay::computeGeometry(ReducedTrajectoryGeometry& geometry,
+											   const dwl_msgs::ReducedBodyTrajectory& msg)
+{
+	unsigned int num_states = msg.trajectory.size() + 1;
+	geometry.time.resize(num_states);
+	geometry.com.resize(num_states);
+	geometry.cop.resize(num_states);
+	geometry.support_idx.resize(num_states + 1);
+	geometry.pendulum_orientation.resize(num_states);
+	geometry.pendulum_length.resize(num_states);
+
+	// Counting the support vertices of all the states
+	unsigned int num_vertexs = msg.actual.support_region.size();
+	for (unsigned int k = 0; k < msg.trajectory.size(); k++)
+		num_vertexs += msg.trajectory[k].support_region.size();
+	geometry.support.resize(num_vertexs);
+
+	Eigen::Vector3d ref_dir = -Eigen::Vector3d::UnitZ();
+	unsigned int vertex_idx = 0;
+	for (unsigned int k = 0; k < num_states; k++) {
+		const dwl_msgs::ReducedBodyState& state =
+				(k == 0) ? msg.actual : msg.trajectory[k - 1];
+
+		// Getting the time, and the center of mass and pressure positions
+		geometry.time[k] = state.time;
+		const geometry_msgs::Vector3& com_vec = state.center_of_mass;
+		const geometry_msgs::Vector3& cop_vec = state.center_of_pressure;
+		geometry.com[k] = Ogre::Vector3(com_vec.x, com_vec.y, com_vec.z);
+		geometry.cop[k] = Ogre::Vector3(cop_vec.x, cop_vec.y, cop_vec.z);
+
+		// Getting the support region
+		geometry.support_idx[k] = vertex_idx;
+		for (unsigned int v = 0; v < state.support_region.size(); v++) {
+			geometry.support[vertex_idx].x = state.support_region[v].x;
+			geometry.support[vertex_idx].y = state.support_region[v].y;
+			geometry.support[vertex_idx].z = state.support_region[v].z;
+			vertex_idx++;
 		}
+
+		// Getting the pendulum direction
+		Eigen::Vector3d pendulum_dir(com_vec.x - cop_vec.x,
+									 com_vec.y - cop_vec.y,
+									 com_vec.z - cop_vec.z);
+		Eigen::Quaterniond pendulum_q;
+		pendulum_q.setFromTwoVectors(ref_dir, pendulum_dir);
+		geometry.pendulum_orientation[k] = Ogre::Quaternion(pendulum_q.w(),
+															pendulum_q.x(),
+															pendulum_q.y(),
+															pendulum_q.z());
+		geometry.pendulum_length[k] = pendulum_dir.norm();
 	}
+	geometry.support_idx[num_states] = vertex_idx;
+
+	// Compute the set of colors
+	generateSetOfColors(geometry.colour, num_states);
 }
 
 
-void ReducedTrajectoryDisplay::displayState(dwl_msgs::ReducedBodyState& state)
+void ReducedTrajectoryDisplay::createObjects()
+{
+	// The full mode draws all the states with a few batched objects, and
+	// the interpolation draws a single state that is updated every frame
+	bool discrete = true;
+	if (mode_display_ == FULL) {
+		createFullObjects();
+		discrete = false;
+	} else if (interpolation_) {
+		createInterpolatedObjects();
+		discrete = false;
+	}
+
+	ReducedTrajectoryVisuals visuals;
+	if (discrete)
+		createStateVisuals(visuals, *geometry_);
+	com_visual_.swap(visuals.com);
+	cop_visual_.swap(visuals.cop);
+	support_visual_.swap(visuals.support);
+	pendulum_visual_.swap(visuals.pendulum);
+
+	updateObjects();
+}
+
+
+void ReducedTrajectoryDisplay::createStateVisuals(ReducedTrajectoryVisuals& visuals,
+												  const ReducedTrajectoryGeometry& geometry)
+{
+	unsigned int num_states = geometry.size();
+	visuals.com.resize(num_states);
+	visuals.cop.resize(num_states);
+	visuals.support.resize(num_states);
+	visuals.pendulum.resize(num_states);
+
+	Ogre::SceneManager* scene_manager = context_->getSceneManager();
+	std::vector<Ogre::Vector3> support;
+	for (unsigned int k = 0; k < num_states; k++) {
+		visuals.com[k].reset(new PointVisual(scene_manager, scene_node_));
+		visuals.com[k]->setPoint(geometry.com[k]);
+
+		visuals.cop[k].reset(new PointVisual(scene_manager, scene_node_));
+		visuals.cop[k]->setPoint(geometry.cop[k]);
+
+		support.assign(geometry.support.begin() + geometry.support_idx[k],
+					   geometry.support.begin() + geometry.support_idx[k + 1]);
+		visuals.support[k].reset(new PolygonVisual(scene_manager, scene_node_));
+		visuals.support[k]->setVertexs(support);
+
+		visuals.pendulum[k].reset(new ArrowVisual(scene_manager, scene_node_));
+		visuals.pendulum[k]->setArrow(geometry.cop[k],
+									  geometry.pendulum_orientation[k]);
+
+		// The visuals are shown by the playback
+		visuals.com[k]->setVisible(false);
+		visuals.cop[k]->setVisible(false);
+		visuals.support[k]->setVisible(false);
+		visuals.pendulum[k]->setVisible(false);
+	}
+}
+
+
+void ReducedTrajectoryDisplay::updateObjects()
+{
+	// Setting the frame, color and properties of the visuals
+	updateFrameTransform();
+	updateCoMRadiusAndAlpha();
+	updateCoPRadiusAndAlpha();
+	updateSupportAlpha();
+	updatePendulumArrowGeometry();
+}
+
+
+void ReducedTrajectoryDisplay::updateFrameTransform()
 {
 	// Here we call the rviz::FrameManager to get the transform from the
 	// fixed frame to the frame in the header of this Point message.  If
@@ -349,104 +637,303 @@ void ReducedTrajectoryDisplay::displayState(dwl_msgs::ReducedBodyState& state)
 		return;
 	}
 
-	// Getting the center of mass position
-	geometry_msgs::Vector3 com_vec = state.center_of_mass;
-	Ogre::Vector3 com_pos(com_vec.x, com_vec.y, com_vec.z);
+	for (unsigned int k = 0; k < com_visual_.size(); k++) {
+		com_visual_[k]->setFramePosition(position);
+		com_visual_[k]->setFrameOrientation(orientation);
+		cop_visual_[k]->setFramePosition(position);
+		cop_visual_[k]->setFrameOrientation(orientation);
+		support_visual_[k]->setFramePosition(position);
+		support_visual_[k]->setFrameOrientation(orientation);
+		pendulum_visual_[k]->setFramePosition(position);
+		pendulum_visual_[k]->setFrameOrientation(orientation);
+	}
 
-	// Getting the actual color
-	Ogre::ColourValue colour = colours_[display_idx_ + 1];
+	batch_node_->setPosition(position);
+	batch_node_->setOrientation(orientation);
 
-	// We are keeping a vector of CoM visual pointers. This creates the next
-	// one and stores it in the vector
-	boost::shared_ptr<PointVisual> com_visual;
-	com_visual.reset(new PointVisual(context_->getSceneManager(), scene_node_));
-	updateCoMRadiusAndAlpha();
-	colour.a = com_alpha_;
-	com_visual->setColor(colour.r, colour.g, colour.b, colour.a);
-	com_visual->setRadius(com_radius_);
-	com_visual->setPoint(com_pos);
-	com_visual->setFramePosition(position);
-	com_visual->setFrameOrientation(orientation);
+	if (interp_com_visual_) {
+		interp_com_visual_->setFramePosition(position);
+		interp_com_visual_->setFrameOrientation(orientation);
+		interp_cop_visual_->setFramePosition(position);
+		interp_cop_visual_->setFrameOrientation(orientation);
+		interp_pendulum_visual_->setFramePosition(position);
+		interp_pendulum_visual_->setFrameOrientation(orientation);
+	}
+}
 
-	// And send it to the end of the vector
-	com_visual_.push_back(com_visual);
 
+void ReducedTrajectoryDisplay::createFullObjects()
+{
+	Ogre::SceneManager* scene_manager = context_->getSceneManager();
+	unsigned int num_states = geometry_->size();
+
+	// All the CoM and CoP points with the color of their state. The radius and
+	// alpha are set per cloud
+	std::vector<rviz::PointCloud::Point> points(num_states);
+	for (unsigned int k = 0; k < num_states; k++) {
+		points[k].position = geometry_->com[k];
+		points[k].color = geometry_->colour[k];
+	}
+	full_com_cloud_.reset(new rviz::PointCloud());
+	full_com_cloud_->setRenderMode(rviz::PointCloud::RM_SPHERES);
+	full_com_cloud_->addPoints(&points.front(), num_states);
+	batch_node_->attachObject(full_com_cloud_.get());
+
+	for (unsigned int k = 0; k < num_states; k++)
+		points[k].position = geometry_->cop[k];
+	full_cop_cloud_.reset(new rviz::PointCloud());
+	full_cop_cloud_->setRenderMode(rviz::PointCloud::RM_SPHERES);
+	full_cop_cloud_->addPoints(&points.front(), num_states);
+	batch_node_->attachObject(full_cop_cloud_.get());
+
+	// The lines and mesh are filled when their properties are updated
+	full_support_line_.reset(new rviz::BillboardLine(scene_manager, batch_node_));
+	full_pendulum_line_.reset(new rviz::BillboardLine(scene_manager, batch_node_));
+	full_support_mesh_.reset(scene_manager->createManualObject());
+	full_support_mesh_->setDynamic(true);
+	batch_node_->attachObject(full_support_mesh_.get());
+}
 
-	// Getting the center of pressure position
-	geometry_msgs::Vector3 cop_vec = state.center_of_pressure;
-	Ogre::Vector3 cop_pos(cop_vec.x, cop_vec.y, cop_vec.z);
 
-	// We are keeping a vector of CoP visual pointers. This creates the
-	// next one and stores it in the vector
-	boost::shared_ptr<PointVisual> cop_visual;
-	cop_visual.reset(new PointVisual(context_->getSceneManager(), scene_node_));
-	updateCoPRadiusAndAlpha();
-	colour.a = cop_alpha_;
-	cop_visual->setColor(colour.r, colour.g, colour.b, colour.a);
-	cop_visual->setRadius(cop_radius_);
-	cop_visual->setPoint(cop_pos);
-	cop_visual->setFramePosition(position);
-	cop_visual->setFrameOrientation(orientation);
+void ReducedTrajectoryDisplay::updateFullSupport()
+{
+	if (!full_support_line_)
+		return;
 
-	// And send it to the end of the vector
-	cop_visual_.push_back(cop_visual);
+	unsigned int num_states = geometry_->size();
+	const std::vector<unsigned int>& support_idx = geometry_->support_idx;
+	const std::vector<Ogre::Vector3>& support = geometry_->support;
 
+	// Lines between all the vertexs of each support region, as in PolygonVisual
+	unsigned int num_lines = 0;
+	for (unsigned int k = 0; k < num_states; k++) {
+		unsigned int num_vertex = support_idx[k + 1] - support_idx[k];
+		if (num_vertex > 1)
+			num_lines += num_vertex * (num_vertex - 1) / 2;
+	}
+	full_support_line_->clear();
+	full_support_line_->setMaxPointsPerLine(2);
+	full_support_line_->setNumLines(num_lines);
+	full_support_line_->setLineWidth(support_line_radius_property_->getFloat());
+
+	unsigned int line = 0;
+	for (unsigned int k = 0; k < num_states; k++) {
+		Ogre::ColourValue colour = geometry_->colour[k];
+		colour.a = support_line_alpha_;
+		for (unsigned int i = support_idx[k]; i < support_idx[k + 1]; i++) {
+			for (unsigned int j = i + 1; j < support_idx[k + 1]; j++) {
+				if (line++ > 0)
+					full_support_line_->newLine();
+				full_support_line_->addPoint(support[i], colour);
+				full_support_line_->addPoint(support[j], colour);
+			}
+		}
+	}
 
-	// Getting the support region
-	std::vector<Ogre::Vector3> support;
-	support.resize(state.support_region.size());
-	for (unsigned int v = 0; v < state.support_region.size(); v++) {
-		support[v].x = state.support_region[v].x;
-		support[v].y = state.support_region[v].y;
-		support[v].z = state.support_region[v].z;
+	// Mesh of all the support regions with per-vertex colors, the triangles
+	// are the same than PolygonVisual
+	full_support_mesh_->clear();
+	full_support_mesh_->estimateVertexCount(support.size());
+	full_support_mesh_->estimateIndexCount(3 * support.size());
+	full_support_mesh_->begin(support_material_->getName(),
+							  Ogre::RenderOperation::OT_TRIANGLE_LIST);
+	unsigned int base = 0;
+	for (unsigned int k = 0; k < num_states; k++) {
+		unsigned int num_vertex = support_idx[k + 1] - support_idx[k];
+		if (num_vertex < 3)
+			continue;
+
+		Ogre::ColourValue colour = geometry_->colour[k];
+		colour.a = support_mesh_alpha_;
+		for (unsigned int i = support_idx[k]; i < support_idx[k + 1]; i++) {
+			full_support_mesh_->position(support[i]);
+			full_support_mesh_->colour(colour);
+		}
+		for (unsigned int i = 0; i < num_vertex; i++) {
+			full_support_mesh_->index(base + i % num_vertex);
+			full_support_mesh_->index(base + (i + 1) % num_vertex);
+			full_support_mesh_->index(base + (i + 2) % num_vertex);
+		}
+		base += num_vertex;
 	}
+	full_support_mesh_->end();
+}
 
-	// Now set or update the contents of the chosen support visual
-	// We are keeping a vector of support regions visual pointers. This
-	// creates the next one and stores it in the vector
-	PolygonVisual* polygon_visual = new PolygonVisual(context_->getSceneManager(), scene_node_);;
-	updateSupportAlpha();
-	polygon_visual->setVertexs(support);
-	polygon_visual->setLineColor(colour.r, colour.g, colour.b, support_line_alpha_);
-	polygon_visual->setLineRadius(support_line_radius_property_->getFloat());
-	polygon_visual->setMeshColor(colour.r, colour.g, colour.b, support_mesh_alpha_);
-	polygon_visual->setFramePosition(position);
-	polygon_visual->setFrameOrientation(orientation);
 
-	// And send it to the end of the vector
-	support_visual_.push_back(polygon_visual);
+void ReducedTrajectoryDisplay::updateFullPendulum()
+{
+	if (!full_pendulum_line_)
+		return;
+
+	// One line from the CoP to the CoM per state
+	unsigned int num_states = geometry_->size();
+	full_pendulum_line_->clear();
+	full_pendulum_line_->setMaxPointsPerLine(2);
+	full_pendulum_line_->setNumLines(num_states);
+	full_pendulum_line_->setLineWidth(pendulum_line_radius_property_->getFloat());
+	for (unsigned int k = 0; k < num_states; k++) {
+		Ogre::ColourValue colour = geometry_->colour[k];
+		colour.a = pendulum_alpha_;
+		if (k > 0)
+			full_pendulum_line_->newLine();
+		full_pendulum_line_->addPoint(geometry_->cop[k], colour);
+		full_pendulum_line_->addPoint(geometry_->com[k], colour);
+	}
+}
 
 
+void ReducedTrajectoryDisplay::createInterpolatedObjects()
+{
+	Ogre::SceneManager* scene_manager = context_->getSceneManager();
+	interp_com_visual_.reset(new PointVisual(scene_manager, scene_node_));
+	interp_cop_visual_.reset(new PointVisual(scene_manager, scene_node_));
+	interp_pendulum_visual_.reset(new ArrowVisual(scene_manager, scene_node_));
+	interp_support_line_.reset(new rviz::BillboardLine(scene_manager, batch_node_));
+
+	// The buffers are sized once for the largest support region, so the
+	// interpolation doesn't allocate
+	unsigned int max_vertex = 3;
+	for (unsigned int k = 0; k < geometry_->size(); k++) {
+		unsigned int num_vertex = geometry_->support_idx[k + 1] - geometry_->support_idx[k];
+		max_vertex = std::max(max_vertex, num_vertex);
+	}
+	interp_support_.resize(max_vertex);
+
+	// The mesh section is filled with degenerated triangles, so it's kept by
+	// Ogre and later updated
+	interp_support_mesh_.reset(scene_manager->createManualObject());
+	interp_support_mesh_->setDynamic(true);
+	interp_support_mesh_->estimateVertexCount(max_vertex);
+	interp_support_mesh_->estimateIndexCount(3 * max_vertex);
+	interp_support_mesh_->begin(support_material_->getName(),
+								Ogre::RenderOperation::OT_TRIANGLE_LIST);
+	for (unsigned int i = 0; i < max_vertex; i++) {
+		interp_support_mesh_->position(Ogre::Vector3::ZERO);
+		interp_support_mesh_->colour(Ogre::ColourValue::ZERO);
+		interp_support_mesh_->index(i);
+		interp_support_mesh_->index(i);
+		interp_support_mesh_->index(i);
+	}
+	interp_support_mesh_->end();
+	batch_node_->attachObject(interp_support_mesh_.get());
+}
+
+
+void ReducedTrajectoryDisplay::interpolateState(double time)
+{
+	if (!interp_com_visual_)
+		return;
+
+	// Getting the consecutive states and the interpolation factor
+	const std::vector<double>& state_time = geometry_->time;
+	std::vector<double>::const_iterator it =
+			std::upper_bound(state_time.begin(), state_time.end(), time);
+	unsigned int i = (it == state_time.begin()) ? 0 : it - state_time.begin() - 1;
+	unsigned int j = std::min(i + 1, geometry_->size() - 1);
+	float s = 0.;
+	if (state_time[j] > state_time[i])
+		s = std::max(0., std::min(1., (time - state_time[i]) / (state_time[j] - state_time[i])));
+
+	// Interpolating the CoM, CoP and color
+	Ogre::Vector3 com = geometry_->com[i] + s * (geometry_->com[j] - geometry_->com[i]);
+	Ogre::Vector3 cop = geometry_->cop[i] + s * (geometry_->cop[j] - geometry_->cop[i]);
+	Ogre::ColourValue colour = geometry_->colour[i] * (1 - s) + geometry_->colour[j] * s;
+
+	interp_com_visual_->setColor(colour.r, colour.g, colour.b, com_alpha_);
+	interp_com_visual_->setRadius(com_radius_);
+	interp_com_visual_->setPoint(com);
+
+	interp_cop_visual_->setColor(colour.r, colour.g, colour.b, cop_alpha_);
+	interp_cop_visual_->setRadius(cop_radius_);
+	interp_cop_visual_->setPoint(cop);
+
 	// Getting the pendulum direction
 	Eigen::Vector3d ref_dir = -Eigen::Vector3d::UnitZ();
-	Eigen::Vector3d pendulum_dir(com_pos.x - cop_pos.x,
-								 com_pos.y - cop_pos.y,
-								 com_pos.z - cop_pos.z);
-
+	Eigen::Vector3d pendulum_dir(com.x - cop.x, com.y - cop.y, com.z - cop.z);
 	Eigen::Quaterniond pendulum_q;
 	pendulum_q.setFromTwoVectors(ref_dir, pendulum_dir);
 	Ogre::Quaternion pendulum_orientation(pendulum_q.w(),
 										  pendulum_q.x(),
 										  pendulum_q.y(),
 										  pendulum_q.z());
+	interp_pendulum_visual_->setArrow(cop, pendulum_orientation);
+	interp_pendulum_visual_->setColor(colour.r, colour.g, colour.b, pendulum_alpha_);
+	interp_pendulum_visual_->setProperties(pendulum_dir.norm(),
+										   pendulum_line_radius_property_->getFloat(),
+										   0., 0.);
+
+	// Morphing the support region when both states have the same number of
+	// vertexs, otherwise the support region of the first state is kept
+	const std::vector<unsigned int>& support_idx = geometry_->support_idx;
+	const std::vector<Ogre::Vector3>& support = geometry_->support;
+	unsigned int num_vertex = support_idx[i + 1] - support_idx[i];
+	if (num_vertex != support_idx[j + 1] - support_idx[j])
+		s = 0.;
+	for (unsigned int v = 0; v < num_vertex; v++) {
+		const Ogre::Vector3& from = support[support_idx[i] + v];
+		const Ogre::Vector3& to = support[support_idx[j] + v];
+		interp_support_[v] = from + s * (to - from);
+	}
 
-	// We are keeping a vector of visual pointers. This creates the next
-	// one and stores it in the vector
-	boost::shared_ptr<ArrowVisual> arrow;
-	arrow.reset(new ArrowVisual(context_->getSceneManager(), scene_node_));
-	arrow->setArrow(cop_pos, pendulum_orientation);
-	arrow->setFramePosition(position);
-	arrow->setFrameOrientation(orientation);
+	// Lines between all the vertexs, as in PolygonVisual. The lines are only
+	// reallocated when the number of vertexs changes
+	unsigned int num_lines = (num_vertex > 1) ? num_vertex * (num_vertex - 1) / 2 : 0;
+	if (num_vertex != interp_support_size_) {
+		interp_support_line_->setMaxPointsPerLine(2);
+		interp_support_line_->setNumLines(num_lines);
+		interp_support_size_ = num_vertex;
+	}
+	interp_support_line_->clear();
+	interp_support_line_->setLineWidth(support_line_radius_property_->getFloat());
+	Ogre::ColourValue line_colour(colour.r, colour.g, colour.b, support_line_alpha_);
+	unsigned int line = 0;
+	for (unsigned int v = 0; v < num_vertex; v++) {
+		for (unsigned int w = v + 1; w < num_vertex; w++) {
+			if (line++ > 0)
+				interp_support_line_->newLine();
+			interp_support_line_->addPoint(interp_support_[v], line_colour);
+			interp_support_line_->addPoint(interp_support_[w], line_colour);
+		}
+	}
 
-	// Setting the arrow color and properties
-	updatePendulumArrowGeometry();
-	arrow->setColor(colour.r, colour.g, colour.b, pendulum_alpha_);
-	float line_length = pendulum_dir.norm();
-	float line_radius = pendulum_line_radius_property_->getFloat();
-	arrow->setProperties(line_length, line_radius, 0., 0.);
+	// Updating the support mesh
+	if (num_vertex >= 3) {
+		Ogre::ColourValue mesh_colour(colour.r, colour.g, colour.b, support_mesh_alpha_);
+		interp_support_mesh_->beginUpdate(0);
+		for (unsigned int v = 0; v < num_vertex; v++) {
+			interp_support_mesh_->position(interp_support_[v]);
+			interp_support_mesh_->colour(mesh_colour);
+		}
+		for (unsigned int v = 0; v < num_vertex; v++) {
+			interp_support_mesh_->index(v % num_vertex);
+			interp_support_mesh_->index((v + 1) % num_vertex);
+			interp_support_mesh_->index((v + 2) % num_vertex);
+		}
+		interp_support_mesh_->end();
+		interp_support_mesh_->setVisible(true);
+	} else
+		interp_support_mesh_->setVisible(false);
+}
+
+
+void ReducedTrajectoryDisplay::setStateVisible(unsigned int idx, bool visible)
+{
+	com_visual_[idx]->setVisible(visible);
+	cop_visual_[idx]->setVisible(visible);
+	support_visual_[idx]->setVisible(visible);
+	pendulum_visual_[idx]->setVisible(visible);
+}
+
+
+void ReducedTrajectoryDisplay::showState(unsigned int idx)
+{
+	if (idx >= com_visual_.size() || (int) idx == shown_idx_)
+		return;
 
-	// And send it to the end of the vector
-	pendulum_visual_.push_back(arrow);
+	if (shown_idx_ >= 0)
+		setStateVisible(shown_idx_, false);
+	setStateVisible(idx, true);
+	shown_idx_ = idx;
 }
 
 
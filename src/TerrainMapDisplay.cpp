@@ -4,18 +4,45 @@
 
 #include <OGRE/OgreSceneNode.h>
 #include <OGRE/OgreSceneManager.h>
+#include <OGRE/OgreManualObject.h>
+#include <OGRE/OgreMaterialManager.h>
+#include <OGRE/OgreTechnique.h>
+#include <OGRE/OgreRoot.h>
+#include <OGRE/OgreRenderSystem.h>
+#include <OGRE/OgreHardwareVertexBuffer.h>
+#include <OGRE/OgreTextureManager.h>
+#include <OGRE/OgreDataStream.h>
+#include <OGRE/OgreCamera.h>
+#include <OGRE/OgreViewport.h>
 
 #include <rviz/visualization_manager.h>
 #include <rviz/frame_manager.h>
+#include <rviz/view_manager.h>
+#include <rviz/view_controller.h>
 #include <rviz/properties/int_property.h>
 #include <rviz/properties/ros_topic_property.h>
 #include <rviz/properties/float_property.h>
 #include <rviz/properties/color_property.h>
 #include <rviz/properties/enum_property.h>
+#include <rviz/properties/string_property.h>
+#include <rviz/properties/bool_property.h>
 
 #include <dwl/environment/SpaceDiscretization.h>
 
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+
+
 #include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 
 using namespace rviz;
@@ -23,10 +50,156 @@ using namespace rviz;
 namespace dwl_rviz_plugin
 {
 
-enum VoxelColorMode {FULL_COLOR, GREY};
+/** @brief Number of cells per side of a tile, as a power of two, and number
+ * of cells of a tile */
+static const unsigned int tile_bits = 6;
+static const unsigned int tile_size = 1 << tile_bits;
+static const unsigned int tile_cells = tile_size * tile_size;
+
+/** @brief Minimum number of cells or slots of a decoding thread, where
+ * starting a thread costs more than decoding them */
+static const unsigned int min_cells_per_thread = 16384;
+
+/** @brief Magic string, version and array alignment of the snapshot files */
+static const char snapshot_magic[8] = {'D', 'W', 'L', 'T', 'M', 'A', 'P', '\0'};
+static const uint32_t snapshot_version = 1;
+static const uint64_t snapshot_alignment = 64;
+
+/** @brief Number of surface vertexs per side of a tile, which has the first
+ * row and column of the next tiles */
+static const unsigned int surface_size = tile_size + 1;
+
+/** @brief Vertexs of the column, surface and normal meshes, which have the
+ * layout of their ManualObject declarations. The texture coordinate is the
+ * cost of the cell */
+struct ColumnVertex
+{
+	void set(const Ogre::Vector3& p, const Ogre::ColourValue& c, float cost) {
+		x = p.x; y = p.y; z = p.z;
+		Ogre::Root::getSingleton().getRenderSystem()->convertColourValue(c, &colour);
+		u = cost;
+	}
+
+	float x, y, z;
+	Ogre::uint32 colour;
+	float u;
+};
+
+struct SurfaceVertex
+{
+	void set(const Ogre::Vector3& p, const Ogre::Vector3& n, float cost) {
+		x = p.x; y = p.y; z = p.z;
+		nx = n.x; ny = n.y; nz = n.z;
+		u = cost;
+	}
+
+	float x, y, z;
+	float nx, ny, nz;
+	float u;
+};
+
+struct LineVertex
+{
+	void set(const Ogre::Vector3& p) {
+		x = p.x; y = p.y; z = p.z;
+	}
+
+	float x, y, z;
+};
+
+/** @brief Number of columns of the coarse levels of a tile, i.e. a quarter of
+ * the cells of the previous level down to a single column */
+static const unsigned int level_cells = (tile_cells - 1) / 3;
+
+/** @brief Estimated memory of a tile, i.e. its decoded slots, its cells in the
+ * render thread, the columns of its coarse levels and its meshes. The column
+ * mesh with its 16-bit indexes is the largest mesh of the render modes, and
+ * it's counted with the normal lines and a voxel per cell, whose point and
+ * cost are kept by the tile as well, so only the voxels of tall columns
+ * exceed the estimate */
+static const unsigned int tile_bytes =
+		tile_cells * (sizeof(TerrainCellSlot) + sizeof(CompactCell) + 1 +
+				8 * sizeof(ColumnVertex) + 30 * sizeof(uint16_t) +
+				2 * sizeof(LineVertex) + 2 * sizeof(rviz::PointCloud::Point) + sizeof(float)) +
+		level_cells * (sizeof(Column) + 1);
+
+
+/** @brief Unmaps a snapshot file, when the last reference to its header is
+ * released */
+struct SnapshotUnmapper
+{
+	SnapshotUnmapper(size_t size) : size(size) {}
+
+	void operator()(const TerrainSnapshotHeader* snapshot) const {
+		munmap(const_cast<TerrainSnapshotHeader*>(snapshot), size);
+	}
+
+	size_t size;
+};
+
+
+/**
+ * @brief Gets the number of decoding threads of a number of cells or slots
+ * @param unsigned int Number of cells or slots
+ * @return Number of threads
+ */
+static unsigned int getNumThreads(unsigned int num_cells)
+{
+	unsigned int num_threads = std::max(1u, boost::thread::hardware_concurrency());
+	return std::max(1u, std::min(num_threads, num_cells / min_cells_per_thread));
+}
+
+
+/** @brief Age of a tile of the accumulated map, which sorts the tiles from the
+ * first one to evict, i.e. the least recently seen and the farthest */
+struct TileAge
+{
+	bool operator<(const TileAge& other) const {
+		if (stamp != other.stamp)
+			return stamp < other.stamp;
+		return distance > other.distance;
+	}
+
+	unsigned int stamp;
+	double distance;
+	unsigned int tile;
+};
+
+
+/**
+ * @brief Writes the vertexs of the sorted dirty slots into the vertex buffer of
+ * a mesh, where the contiguous slots are written together
+ * @param Ogre::ManualObject* Mesh
+ * @param const std::vector<unsigned int>& Sorted dirty slots
+ * @param const std::vector<Vertex>& Vertexs of the dirty slots
+ * @param unsigned int Number of vertexs per slot
+ */
+template <typename Vertex>
+static void writeSlotVertexs(Ogre::ManualObject* object,
+							 const std::vector<unsigned int>& slots,
+							 const std::vector<Vertex>& vertexs,
+							 unsigned int slot_vertexs)
+{
+	Ogre::HardwareVertexBufferSharedPtr buffer =
+			object->getSection(0)->getRenderOperation()->vertexData->vertexBufferBinding->getBuffer(0);
+	unsigned int begin = 0;
+	while (begin < slots.size()) {
+		unsigned int end = begin + 1;
+		while (end < slots.size() && slots[end] == slots[end - 1] + 1)
+			end++;
+
+		buffer->writeData(slots[begin] * slot_vertexs * sizeof(Vertex),
+						  (end - begin) * slot_vertexs * sizeof(Vertex),
+						  &vertexs[begin * slot_vertexs]);
+		begin = end;
+	}
+}
+
 
-TerrainMapDisplay::TerrainMapDisplay() : rviz::Display(), messages_received_(0),
-		color_factor_(0.8),	grid_size_(std::numeric_limits<double>::max()),
+TerrainMapDisplay::TerrainMapDisplay() : rviz::Display(), render_mode_(VOXELS),
+		messages_received_(0),
+		grid_size_(std::numeric_limits<double>::max()),
+		height_size_(0.),
 		max_cost_(0.), min_cost_(std::numeric_limits<double>::max()),
 		min_key_z_(std::numeric_limits<unsigned int>::max())
 {
@@ -46,6 +219,73 @@ TerrainMapDisplay::TerrainMapDisplay() : rviz::Display(), messages_received_(0),
 							this, SLOT(updateQueueSize()));
 	queue_size_property_->setMin(1);
 
+	queue_budget_property_ =
+			new IntProperty("Queue Budget", 64,
+							"Memory of the received messages that wait for the decoding, in "
+							"megabytes. A message supersedes the waiting messages, so they "
+							"are dropped, unless the map is accumulated. Otherwise the "
+							"oldest messages are dropped when the budget is exceeded.",
+							this, SLOT(updateQueueBudget()));
+	queue_budget_property_->setMin(1);
+
+	render_mode_property_ =
+			new rviz::EnumProperty("Render Mode", "Voxels",
+								   "Voxels draws a box per height step down to the "
+								   "lowest cell, Columns draws a stretched box per "
+								   "cell, and Surface draws a heightfield mesh that "
+								   "is shaded by the surface normals.",
+								   this, SLOT(updateRenderMode()), this);
+	render_mode_property_->addOption("Voxels", VOXELS);
+	render_mode_property_->addOption("Columns", COLUMNS);
+	render_mode_property_->addOption("Surface", SURFACE);
+
+	lod_size_property_ =
+			new FloatProperty("LOD Pixel Size", 2.,
+							  "Minimum projected size of a cell, in pixels. The far tiles "
+							  "are drawn with coarser cells, which are blocks of cells, and "
+							  "0 draws all the cells.",
+							  this, SLOT(updateLevelOfDetail()));
+	lod_size_property_->setMin(0);
+
+	rolling_window_property_ =
+			new rviz::BoolProperty("Rolling Window", false,
+								   "Enable it for robot-centric maps. The tiles are a ring of the "
+								   "tiles of the window, so the tiles that leave the window are "
+								   "taken by the tiles that enter it, and only the entered cells "
+								   "are written.",
+								   this, SLOT(updateRollingWindow()), this);
+
+	accumulate_property_ =
+			new rviz::BoolProperty("Accumulate", false,
+								   "Keeps the cells of the previous messages, which builds a map "
+								   "of the seen terrain. The tiles that don't fit in the memory "
+								   "budget are evicted, from the least recently seen and the "
+								   "farthest from the robot. It disables the rolling window.",
+								   this, SLOT(updateAccumulate()), this);
+
+	memory_budget_property_ =
+			new IntProperty("Memory Budget", 512,
+							"Memory of the accumulated map, in megabytes. The memory of a tile is "
+							"estimated with a voxel per cell, so the voxels of tall columns can "
+							"exceed it.",
+							accumulate_property_, SLOT(updateMemoryBudget()), this);
+	memory_budget_property_->setMin(16);
+
+	// Snapshot properties, where save and load act as buttons
+	snapshot_category_ = new rviz::Property("Snapshot", QVariant(), "", this);
+	snapshot_file_property_ =
+			new StringProperty("File", "terrain_map.snapshot",
+							   "File of the snapshot of the decoded map.",
+							   snapshot_category_);
+	save_snapshot_property_ =
+			new rviz::BoolProperty("Save", false,
+								   "Saves the drawn map into the file.",
+								   snapshot_category_, SLOT(updateSnapshot()), this);
+	load_snapshot_property_ =
+			new rviz::BoolProperty("Load", false,
+								   "Loads the map of the file, which is decoded as a message.",
+								   snapshot_category_, SLOT(updateSnapshot()), this);
+
 	normal_enable_property_ =
 			new rviz::BoolProperty("Normal", "Points",
 							 	   "Enable the rendering of surface normals.",
@@ -65,6 +305,10 @@ TerrainMapDisplay::TerrainMapDisplay() : rviz::Display(), messages_received_(0),
 								   SLOT(updateColorMode()), this);
 	voxel_color_property_->addOption("Full Color", FULL_COLOR);
 	voxel_color_property_->addOption("Grey", GREY);
+	voxel_color_property_->addOption("Viridis", VIRIDIS);
+	voxel_color_property_->addOption("Magma", MAGMA);
+	voxel_color_property_->addOption("Inferno", INFERNO);
+	voxel_color_property_->addOption("Plasma", PLASMA);
 
 
 	// Surface normal vector properties
@@ -81,103 +325,177 @@ TerrainMapDisplay::TerrainMapDisplay() : rviz::Display(), messages_received_(0),
 	normal_alpha_property_->setMax(1);
 
 
-	normal_shaft_length_property_ =
-			new FloatProperty("Shaft Length", 0.04,
-							  "Length of the arrow's shaft, in meters.",
-							  normal_category_, SLOT(updateNormalArrowGeometry()), this);
-
-	normal_shaft_radius_property_ =
-			new FloatProperty("Shaft Radius", 0.005,
-							  "Radius of the arrow's shaft, in meters.",
-							  normal_category_, SLOT(updateNormalArrowGeometry()), this);
-
-	normal_head_length_property_ =
-			new FloatProperty("Head Length", 0.05,
-							  "Length of the arrow's head, in meters.",
-							  normal_category_, SLOT(updateNormalArrowGeometry()), this);
-
-	normal_head_radius_property_ =
-			new FloatProperty("Head Radius", 0.012,
-							  "Radius of the arrow's head, in meters.",
-							  normal_category_, SLOT(updateNormalArrowGeometry()), this);
-
-	new_points_received_ = false;
+	normal_length_property_ =
+			new FloatProperty("Length", 0.09,
+							  "Length of the normal lines, in meters.",
+							  normal_category_, SLOT(updateNormalLines()), this);
+	normal_length_property_->setMin(0);
+
+	normal_stride_property_ =
+			new IntProperty("Stride", 1,
+							"Draws one of every stride normals.",
+							normal_category_, SLOT(updateNormalLines()), this);
+	normal_stride_property_->setMin(1);
+
+	generation_ = 0;
+	redraw_ = false;
+	transform_pending_ = false;
+	slot_stamp_ = 0;
+	full_rewrite_ = false;
+	decode_generation_ = 0;
+	rolling_window_ = false;
+	ring_tiles_ = false;
+	ring_x_ = 0;
+	ring_y_ = 0;
+	accumulate_ = false;
+	memory_budget_ = memory_budget_property_->getInt();
+	accumulate_tiles_ = false;
+	num_evicted_ = 0;
+	colormap_changed_ = false;
+	// The queued bytes of the status can't be queued, so the first update
+	// shows the status
+	status_queued_bytes_ = std::numeric_limits<size_t>::max();
+	status_dropped_ = 0;
+	queue_.setBudget((size_t) queue_budget_property_->getInt() << 20);
+	queue_.setLatestWins(true);
 }
 
 
 TerrainMapDisplay::~TerrainMapDisplay()
 {
 	unsubscribe();
+	queue_.stop();
 
-	delete cloud_;
 	destroyObjects();
 
 	if (scene_node_)
 		scene_node_->detachAllObjects();
+
+	// Removing the materials and colormap textures, which are created by the
+	// initialization
+	if (!column_material_.isNull()) {
+		Ogre::MaterialManager::getSingleton().remove(column_material_->getName());
+		Ogre::MaterialManager::getSingleton().remove(surface_material_->getName());
+		Ogre::MaterialManager::getSingleton().remove(normal_material_->getName());
+	}
+	for (unsigned int i = 0; i < colormap_textures_.size(); i++) {
+		if (!colormap_textures_[i].isNull())
+			Ogre::TextureManager::getSingleton().remove(colormap_textures_[i]->getName());
+	}
 }
 
 
 void TerrainMapDisplay::update(float wall_dt, float ros_dt)
 {
-	if (new_points_received_) {
-		boost::mutex::scoped_lock lock(mutex_);
-
-		// Drawing the terrain cost values
-		cloud_->clear();
-		cloud_->setDimensions(grid_size_, grid_size_, height_size_);
-		cloud_->addPoints(&new_points_.front(), new_points_.size());
-
-		// Drawing the normal vectors
-		arrow_cloud_.clear();
-		if (normal_enable_property_) {
-			arrow_cloud_.resize(normal_buf_.size());
-			Ogre::ColourValue color = normal_color_property_->getOgreColor();
-			color.a = normal_alpha_property_->getFloat();
-			float shaft_length = normal_shaft_length_property_->getFloat();
-			float shaft_radius = normal_shaft_radius_property_->getFloat();
-			float head_length = normal_head_length_property_->getFloat();
-			float head_radius = normal_head_radius_property_->getFloat();
-			for (unsigned int j = 0; j < normal_buf_.size(); j++) {
-				boost::shared_ptr<ArrowVisual> arrow;
-				arrow.reset(new ArrowVisual(context_->getSceneManager(), scene_node_));
-
-				arrow->setArrow(normal_buf_[j].origin, normal_buf_[j].orientation);
-				arrow->setFramePosition(position_);
-				arrow->setFrameOrientation(orientation_);
-
-				// Setting the arrow color and properties
-				arrow->setColor(color.r, color.g, color.b, color.a);
-				arrow->setProperties(shaft_length, shaft_radius,
-									 head_length, head_radius);
-
-				arrow_cloud_[j] = arrow;
-			}
-		}
+	// Taking the last published frame, where the frames of a previous
+	// generation were decoded before the display was cleared
+	boost::shared_ptr<TerrainMapFrame> frame =
+			boost::atomic_exchange(&frame_, boost::shared_ptr<TerrainMapFrame>());
+	if (frame && frame->generation == generation_)
+		applyFrame(*frame);
+
+	if (transform_pending_)
+		updateTransform();
+
+	updateQueueStatus();
+
+	// Mapping the costs of the meshes and voxels to the colormap, where the
+	// expanded voxels are only colored again
+	if (colormap_changed_) {
+		updateColormap();
+		for (unsigned int t = 0; t < tiles_.size(); t++)
+			tiles_[t]->voxels_recolored = true;
+		colormap_changed_ = false;
+	}
 
-		new_points_received_ = false;
+	// Choosing the level of each tile, where the far tiles are drawn with
+	// coarser cells
+	updateLevels();
+
+	for (unsigned int t = 0; t < tiles_.size(); t++) {
+		TerrainTile& tile = *tiles_[t];
+		if (tile.voxels_changed)
+			drawVoxels(tile);
+		else if (tile.voxels_recolored)
+			colorVoxels(tile);
+		tile.voxels_changed = false;
+		tile.voxels_recolored = false;
+
+		// Rewriting only the dirty cells of the changed tiles, unless their
+		// buffers have to be built again. The coarse levels are small, so they
+		// are always built again
+		if (!redraw_ || (!tile.redraw_all && !tile.retriangulate &&
+				tile.redraw_cells.empty() && tile.redraw_vertexs.empty()))
+			continue;
+
+		bool rewrite = !tile.redraw_all && tile.level == 0;
+		if (render_mode_ == COLUMNS && rewrite &&
+				hasVertexBuffer(tile.column_object.get(), 8 * tile_cells))
+			writeColumns(tile);
+		else
+			drawColumns(tile);
+		if (render_mode_ == SURFACE && rewrite && !tile.retriangulate &&
+				hasVertexBuffer(tile.surface_object.get(), surface_size * surface_size))
+			writeSurface(tile);
+		else
+			drawSurface(tile);
+		if (rewrite && hasVertexBuffer(tile.normal_object.get(), 2 * tile_cells))
+			writeNormals(tile);
+		else
+			drawNormals(tile);
+
+		tile.redraw_cells.clear();
+		tile.redraw_vertexs.clear();
+		tile.redraw_all = false;
+		tile.retriangulate = false;
 	}
+	redraw_ = false;
 }
 
 
 void TerrainMapDisplay::reset()
 {
 	clear();
-	messages_received_ = 0;
+	queue_.resetDropped();
+	status_queued_bytes_ = std::numeric_limits<size_t>::max();
 	setStatus(StatusProperty::Ok, "Messages",
 			QString("0 terrain map messages received"));
+	deleteStatusStd("Tiles");
 }
 
 
 void TerrainMapDisplay::onInitialize()
 {
-	boost::mutex::scoped_lock lock(mutex_);
-
-	std::stringstream sname;
-	sname << "PointCloud Nr.";// << i;
-	cloud_ = new rviz::PointCloud();
-	cloud_->setName(sname.str());
-	cloud_->setRenderMode(rviz::PointCloud::RM_BOXES);
-	scene_node_->attachObject((Ogre::MovableObject*) cloud_);
+	// The column and surface meshes map their costs through a colormap
+	// texture, so they aren't written again when the colors change. The
+	// materials are shared by the meshes of all the tiles
+	createColormaps();
+
+	static int count = 0;
+	std::stringstream ss;
+	ss << "TerrainColumn" << count++;
+	column_material_ = Ogre::MaterialManager::getSingleton().create(ss.str(), "rviz");
+	column_material_->setReceiveShadows(false);
+	column_material_->setLightingEnabled(false);
+	createColormapUnit(column_material_);
+
+	ss.str("");
+	ss << "TerrainSurface" << count++;
+	surface_material_ = Ogre::MaterialManager::getSingleton().create(ss.str(), "rviz");
+	surface_material_->setReceiveShadows(false);
+	surface_material_->setCullingMode(Ogre::CULL_NONE);
+	createColormapUnit(surface_material_);
+	updateColormap();
+
+	ss.str("");
+	ss << "TerrainNormal" << count++;
+	normal_material_ = Ogre::MaterialManager::getSingleton().create(ss.str(), "rviz");
+	normal_material_->setReceiveShadows(false);
+	normal_material_->setSceneBlending(Ogre::SBT_TRANSPARENT_ALPHA);
+	normal_material_->setDepthWriteEnabled(false);
+	updateNormalArrowGeometry();
+
+	queue_.start(boost::bind(&TerrainMapDisplay::processMessage, this, _1));
 }
 
 
@@ -199,9 +517,15 @@ void TerrainMapDisplay::onDisable()
 
 void TerrainMapDisplay::destroyObjects()
 {
-	point_buf_.clear();
-	new_points_.clear();
-	normal_buf_.clear();
+	for (unsigned int t = 0; t < tiles_.size(); t++)
+		destroyTileNode(*tiles_[t]);
+	tiles_.clear();
+	tile_indexes_.clear();
+	cells_.clear();
+	used_.clear();
+	map_info_ = TerrainMapInfo();
+	redraw_ = false;
+	transform_pending_ = false;
 }
 
 
@@ -216,7 +540,7 @@ void TerrainMapDisplay::subscribe()
 		const std::string& topicStr = topic_property_->getStdString();
 
 		if (!topicStr.empty()) {
-			sub_.reset(new message_filters::Subscriber<terrain_server::TerrainMap>());
+			sub_.reset(new message_filters::Subscriber<TerrainMapStream>());
 
 			sub_->subscribe(threaded_nh_, topicStr, queue_size_);
 			sub_->registerCallback(boost::bind(&TerrainMapDisplay::incomingMessageCallback, this, _1));
@@ -234,8 +558,10 @@ void TerrainMapDisplay::unsubscribe()
 	clear();
 
 	try {
-		// reset filters
+		// reset filters, and drop the messages of the topic that wait for the
+		// decoding
 		sub_.reset();
+		queue_.clear();
 	}
 	catch (ros::Exception& e) {
 		setStatus(StatusProperty::Error, "Topic",
@@ -244,163 +570,1463 @@ void TerrainMapDisplay::unsubscribe()
 }
 
 
-void TerrainMapDisplay::incomingMessageCallback(const terrain_server::TerrainMapConstPtr& msg)
+void TerrainMapDisplay::incomingMessageCallback(const TerrainMapStream::ConstPtr& msg)
 {
-	++messages_received_;
-	setStatus(StatusProperty::Ok, "Messages",
-			QString::number(messages_received_) + " terrain map messages received");
+	// The message only waits in the queue, so the subscriber queue doesn't
+	// keep the messages while a message is decoded
+	queue_.push(msg, msg->getSize());
+}
+
 
+void TerrainMapDisplay::processMessage(const TerrainMapStream::ConstPtr& msg)
+{
+	// The decoded state isn't shared with the render thread, so it never
+	// waits on the decoding. The message isn't kept, since its cells are
+	// copied into their slots
 	boost::mutex::scoped_lock lock(mutex_);
-	terrain_msg_ = msg;
+	reclaimFrame();
+
+	// Decoding the cells of the terrain map, where only the added, removed or
+	// changed cells are written again. A loaded snapshot is read in place
+	// from its mapped file
+	if (msg->snapshot)
+		decodeSnapshot(*msg->snapshot);
+	else {
+		++messages_received_;
+		header_ = msg->header;
+		decodeMap(*msg);
+	}
+	publishFrame();
+}
 
-	// Destroy all the old elements
-	destroyObjects();
 
-	// Getting tf transform
-	if (!context_->getFrameManager()->getTransform(terrain_msg_->header,
-												   position_,
-												   orientation_)) {
+void TerrainMapDisplay::reclaimFrame()
+{
+	// Dropping the decoded state of a previous generation, i.e. the display
+	// was cleared
+	unsigned int generation = generation_;
+	if (generation != decode_generation_) {
+		tile_map_.clear();
+		slots_.clear();
+		tile_keys_.clear();
+		tile_cells_.clear();
+		tile_stamps_.clear();
+		free_tiles_.clear();
+		dirty_slots_.clear();
+		messages_received_ = 0;
+		grid_size_ = std::numeric_limits<double>::max();
+		height_size_ = 0.;
+		max_cost_ = 0.;
+		min_cost_ = std::numeric_limits<double>::max();
+		min_key_z_ = std::numeric_limits<unsigned int>::max();
+		accumulate_tiles_ = accumulate_;
+		ring_tiles_ = rolling_window_ && !accumulate_tiles_;
+		ring_x_ = 0;
+		ring_y_ = 0;
+		num_evicted_ = 0;
+		decode_generation_ = generation;
+	}
+
+	// The dirty slots of a frame that the render thread didn't take are kept,
+	// so they are published again with the next changes. Otherwise the next
+	// frame only has the next changes
+	boost::shared_ptr<TerrainMapFrame> frame =
+			boost::atomic_exchange(&frame_, boost::shared_ptr<TerrainMapFrame>());
+	if (!frame || frame->generation != decode_generation_) {
+		for (unsigned int i = 0; i < dirty_slots_.size(); i++)
+			slots_[dirty_slots_[i]].dirty = false;
+		dirty_slots_.clear();
+		full_rewrite_ = false;
+	}
+}
+
+
+void TerrainMapDisplay::publishFrame()
+{
+	boost::shared_ptr<TerrainMapFrame> frame(new TerrainMapFrame());
+	frame->generation = decode_generation_;
+	frame->info.header = header_;
+	frame->info.num_messages = messages_received_;
+	frame->info.grid_size = grid_size_;
+	frame->info.height_size = height_size_;
+	frame->info.max_cost = max_cost_;
+	frame->info.min_cost = min_cost_;
+	frame->info.plane_origin = plane_origin_;
+	frame->info.height_origin = height_origin_;
+	frame->info.min_key_z = min_key_z_;
+	frame->info.num_tiles = tile_cells_.size() - std::count(tile_cells_.begin(), tile_cells_.end(), 0u);
+	frame->info.num_evicted = num_evicted_;
+	frame->tile_keys = tile_keys_;
+	frame->tile_cells = tile_cells_;
+	frame->full_rewrite = full_rewrite_;
+
+	// Copying the compact cells of the sorted dirty slots, so the contiguous
+	// slots are written together in the meshes
+	std::sort(dirty_slots_.begin(), dirty_slots_.end());
+	frame->dirty_slots = dirty_slots_;
+	frame->used.resize(dirty_slots_.size());
+	frame->cells.resize(dirty_slots_.size());
+	for (unsigned int i = 0; i < dirty_slots_.size(); i++) {
+		const TerrainCellSlot& cell_slot = slots_[dirty_slots_[i]];
+		frame->used[i] = cell_slot.used;
+		frame->cells[i] = cell_slot.cell;
+	}
+
+	boost::atomic_store(&frame_, frame);
+}
+
+
+void TerrainMapDisplay::decodeMap(const TerrainMapStream& msg)
+{
+	// Getting the number of cells
+	unsigned int num_cells = msg.key_x.size();
+	double grid_size = grid_size_;
+	double height_size = height_size_;
+	grid_size_ = msg.plane_size;
+	height_size_ = msg.height_size;
+
+	// Getting the coordinates of the zero keys, so the coordinates of the
+	// voxels are computed without converting every key
+	dwl::environment::SpaceDiscretization space_discretization(grid_size_);
+	space_discretization.setEnvironmentResolution(height_size_, false);
+	space_discretization.keyToCoord(plane_origin_, (unsigned short) 0, true);
+	space_discretization.keyToCoord(height_origin_, (unsigned short) 0, false);
+
+	// The cost range and the key bounds were computed while the message was
+	// parsed, so the cells are only walked by the diff pass
+	unsigned int min_key_z = min_key_z_;
+	double max_cost = max_cost_;
+	double min_cost = min_cost_;
+	max_cost_ = msg.max_cost;
+	min_cost_ = msg.min_cost;
+	min_key_z_ = msg.min_key_z;
+	TerrainCellRange bounds;
+	bounds.min_tile_x = std::numeric_limits<unsigned int>::max();
+	bounds.max_tile_x = 0;
+	bounds.min_tile_y = std::numeric_limits<unsigned int>::max();
+	bounds.max_tile_y = 0;
+	if (num_cells != 0) {
+		bounds.min_tile_x = msg.min_key_x >> tile_bits;
+		bounds.max_tile_x = msg.max_key_x >> tile_bits;
+		bounds.min_tile_y = msg.min_key_y >> tile_bits;
+		bounds.max_tile_y = msg.max_key_y >> tile_bits;
+	}
+
+	// The accumulated map has the cells of the previous messages, so its
+	// ranges only grow
+	if (accumulate_tiles_ && messages_received_ > 1) {
+		max_cost_ = std::max(max_cost_, max_cost);
+		min_cost_ = std::min(min_cost_, min_cost);
+		min_key_z_ = std::min(min_key_z_, min_key_z);
+	}
+
+	if (ring_tiles_ && num_cells != 0)
+		fitRing(bounds);
+
+	// Diff pass, which finds the slot of each cell by its tile and its place
+	// in the tile. Only the new or changed cells are dirty, where the changes
+	// that the compact cell can't keep aren't drawn either
+	slot_stamp_++;
+	if (num_cells != 0) {
+		TerrainCellArrays cells;
+		cells.key_x = &msg.key_x.front();
+		cells.key_y = &msg.key_y.front();
+		cells.key_z = &msg.key_z.front();
+		cells.cost = &msg.cost.front();
+		cells.normal = &msg.normal.front();
+		cells.num_cells = num_cells;
+		storeCells(cells);
+	}
+	removeCells(bounds);
+
+	// The positions of all the cells depend on the resolution and the lowest
+	// height key, so all the slots are rewritten when they change. Instead the
+	// cost range only changes the mapping of the colormap
+	if (grid_size != grid_size_ || height_size != height_size_ || min_key_z != min_key_z_)
+		markAllDirty();
+}
+
+
+unsigned int TerrainMapDisplay::takeTile(uint32_t tile_key)
+{
+	// The new tiles take a free tile, or their place in the ring
+	if (ring_tiles_)
+		return takeRingTile(tile_key);
+
+	TileMap::iterator it = tile_map_.find(tile_key);
+	if (it != tile_map_.end())
+		return it->second;
+
+	unsigned int tile;
+	if (free_tiles_.empty()) {
+		tile = tile_keys_.size();
+		tile_keys_.push_back(tile_key);
+		tile_cells_.push_back(0);
+		tile_stamps_.push_back(0);
+		slots_.resize(slots_.size() + tile_cells);
+	} else {
+		tile = free_tiles_.back();
+		free_tiles_.pop_back();
+		tile_keys_[tile] = tile_key;
+	}
+	tile_map_[tile_key] = tile;
+
+	return tile;
+}
+
+
+void TerrainMapDisplay::storeCells(const TerrainCellArrays& cells)
+{
+	// Tile pass, which takes the tiles of the cells before the slots are
+	// written, so the slots aren't resized by the threads. The consecutive
+	// cells are mostly in the same tile, so a tile is only looked up when the
+	// tile key changes
+	cell_tiles_.resize(cells.num_cells);
+	uint32_t last_key = std::numeric_limits<uint32_t>::max();
+	unsigned int tile = 0;
+	for (unsigned int i = 0; i < cells.num_cells; i++) {
+		uint32_t tile_key =
+				((uint32_t) (cells.key_x[i] >> tile_bits) << 16) | (cells.key_y[i] >> tile_bits);
+		if (tile_key != last_key) {
+			tile = takeTile(tile_key);
+			tile_stamps_[tile] = slot_stamp_;
+			last_key = tile_key;
+		}
+		cell_tiles_[i] = tile;
+	}
+
+	// Slot pass, where each thread only writes the slots and the cell count
+	// of its tiles
+	unsigned int num_threads = getNumThreads(cells.num_cells);
+	thread_dirty_slots_.resize(num_threads);
+	boost::thread_group threads;
+	for (unsigned int t = 1; t < num_threads; t++)
+		threads.create_thread(boost::bind(&TerrainMapDisplay::storeTileCells,
+										  this, boost::cref(cells), t, num_threads));
+	storeTileCells(cells, 0, num_threads);
+	threads.join_all();
+	mergeDirtySlots(num_threads);
+}
+
+
+void TerrainMapDisplay::storeTileCells(const TerrainCellArrays& cells,
+									   unsigned int thread,
+									   unsigned int num_threads)
+{
+	std::vector<unsigned int>& dirty_slots = thread_dirty_slots_[thread];
+	dirty_slots.clear();
+	CompactCell cell;
+	for (unsigned int i = 0; i < cells.num_cells; i++) {
+		unsigned int tile = cell_tiles_[i];
+		if (tile % num_threads != thread)
+			continue;
+
+		cell.key_z = cells.key_z[i];
+		cell.cost = cells.cost[i];
+		cell.normal = cells.normal[i];
+		unsigned int slot = tile * tile_cells +
+				((cells.key_y[i] & (tile_size - 1)) << tile_bits) + (cells.key_x[i] & (tile_size - 1));
+		TerrainCellSlot& cell_slot = slots_[slot];
+		if (!cell_slot.used) {
+			cell_slot.used = true;
+			cell_slot.cell = cell;
+			tile_cells_[tile]++;
+			markDirty(slot, dirty_slots);
+		} else if (cell != cell_slot.cell) {
+			cell_slot.cell = cell;
+			markDirty(slot, dirty_slots);
+		}
+		cell_slot.stamp = slot_stamp_;
+	}
+}
+
+
+void TerrainMapDisplay::removeCells(const TerrainCellRange& bounds)
+{
+	// The cells that weren't stored are removed, and the tiles without cells
+	// are freed, except the tiles of the ring that keep their place. The
+	// accumulated map keeps its cells, and it only evicts whole tiles
+	if (accumulate_tiles_) {
+		evictTiles(bounds);
+		return;
+	}
+
+	// Each thread scans the slots of a range of tiles, and the freed tiles
+	// are released after, since the tile map is shared
+	unsigned int num_tiles = tile_keys_.size();
+	unsigned int num_threads = std::min(getNumThreads(slots_.size()), std::max(num_tiles, 1u));
+	thread_dirty_slots_.resize(num_threads);
+	thread_free_tiles_.resize(num_threads);
+	boost::thread_group threads;
+	for (unsigned int t = 1; t < num_threads; t++)
+		threads.create_thread(boost::bind(&TerrainMapDisplay::removeTileCells, this,
+										  num_tiles * t / num_threads,
+										  num_tiles * (t + 1) / num_threads, t));
+	removeTileCells(0, num_tiles / num_threads, 0);
+	threads.join_all();
+
+	for (unsigned int t = 0; t < num_threads; t++) {
+		const std::vector<unsigned int>& free_tiles = thread_free_tiles_[t];
+		for (unsigned int i = 0; i < free_tiles.size(); i++) {
+			tile_map_.erase(tile_keys_[free_tiles[i]]);
+			free_tiles_.push_back(free_tiles[i]);
+		}
+	}
+	mergeDirtySlots(num_threads);
+}
+
+
+void TerrainMapDisplay::removeTileCells(unsigned int first_tile,
+										unsigned int end_tile,
+										unsigned int thread)
+{
+	std::vector<unsigned int>& dirty_slots = thread_dirty_slots_[thread];
+	std::vector<unsigned int>& free_tiles = thread_free_tiles_[thread];
+	dirty_slots.clear();
+	free_tiles.clear();
+	for (unsigned int slot = first_tile * tile_cells; slot < end_tile * tile_cells; slot++) {
+		TerrainCellSlot& cell_slot = slots_[slot];
+		if (cell_slot.used && cell_slot.stamp != slot_stamp_) {
+			cell_slot.used = false;
+			markDirty(slot, dirty_slots);
+
+			unsigned int tile = slot / tile_cells;
+			if (--tile_cells_[tile] == 0 && !ring_tiles_)
+				free_tiles.push_back(tile);
+		}
+	}
+}
+
+
+void TerrainMapDisplay::mergeDirtySlots(unsigned int num_threads)
+{
+	for (unsigned int t = 0; t < num_threads; t++) {
+		const std::vector<unsigned int>& dirty_slots = thread_dirty_slots_[t];
+		dirty_slots_.insert(dirty_slots_.end(), dirty_slots.begin(), dirty_slots.end());
+	}
+}
+
+
+void TerrainMapDisplay::decodeSnapshot(const TerrainSnapshotHeader& snapshot)
+{
+	// The arrays are read in place from the mapped file, and their cells are
+	// already compact
+	const char* data = reinterpret_cast<const char*>(&snapshot);
+	const uint16_t* key_x = reinterpret_cast<const uint16_t*>(data + snapshot.offsets[0]);
+	const uint16_t* key_y = reinterpret_cast<const uint16_t*>(data + snapshot.offsets[1]);
+	const uint16_t* key_z = reinterpret_cast<const uint16_t*>(data + snapshot.offsets[2]);
+	const uint16_t* costs = reinterpret_cast<const uint16_t*>(data + snapshot.offsets[3]);
+	const uint32_t* normals = reinterpret_cast<const uint32_t*>(data + snapshot.offsets[4]);
+
+	header_.frame_id = std::string(snapshot.frame_id,
+								   strnlen(snapshot.frame_id, sizeof(snapshot.frame_id)));
+	header_.stamp = ros::Time();
+	grid_size_ = snapshot.grid_size;
+	height_size_ = snapshot.height_size;
+	plane_origin_ = snapshot.plane_origin;
+	height_origin_ = snapshot.height_origin;
+
+	// The accumulated map keeps its cells, so its ranges only grow
+	bool merge = accumulate_tiles_ && !tile_map_.empty();
+	max_cost_ = merge ? std::max(max_cost_, snapshot.max_cost) : snapshot.max_cost;
+	min_cost_ = merge ? std::min(min_cost_, snapshot.min_cost) : snapshot.min_cost;
+	min_key_z_ = merge ? std::min(min_key_z_, snapshot.min_key_z) : snapshot.min_key_z;
+
+	TerrainCellRange bounds;
+	bounds.min_tile_x = std::numeric_limits<unsigned int>::max();
+	bounds.max_tile_x = 0;
+	bounds.min_tile_y = std::numeric_limits<unsigned int>::max();
+	bounds.max_tile_y = 0;
+	for (unsigned int i = 0; i < snapshot.num_cells; i++) {
+		bounds.min_tile_x = std::min(bounds.min_tile_x, (unsigned int) key_x[i] >> tile_bits);
+		bounds.max_tile_x = std::max(bounds.max_tile_x, (unsigned int) key_x[i] >> tile_bits);
+		bounds.min_tile_y = std::min(bounds.min_tile_y, (unsigned int) key_y[i] >> tile_bits);
+		bounds.max_tile_y = std::max(bounds.max_tile_y, (unsigned int) key_y[i] >> tile_bits);
+	}
+	if (ring_tiles_ && snapshot.num_cells != 0)
+		fitRing(bounds);
+
+	slot_stamp_++;
+	TerrainCellArrays cells;
+	cells.key_x = key_x;
+	cells.key_y = key_y;
+	cells.key_z = key_z;
+	cells.cost = costs;
+	cells.normal = normals;
+	cells.num_cells = snapshot.num_cells;
+	storeCells(cells);
+	removeCells(bounds);
+
+	// The snapshot can have another resolution, so all the slots are rewritten
+	markAllDirty();
+}
+
+
+void TerrainMapDisplay::saveSnapshot(const std::string& file_name)
+{
+	// Gathering the used cells of the render thread as arrays
+	std::vector<uint16_t> key_x, key_y, key_z, costs;
+	std::vector<uint32_t> normals;
+	for (unsigned int t = 0; t < tiles_.size(); t++) {
+		const TerrainTile& tile = *tiles_[t];
+		if (tile.num_cells == 0)
+			continue;
+
+		unsigned int first_slot = tile.index * tile_cells;
+		for (unsigned int cell = 0; cell < tile_cells; cell++) {
+			unsigned int slot = first_slot + cell;
+			if (!used_[slot])
+				continue;
+
+			key_x.push_back(((tile.key >> 16) << tile_bits) + (cell & (tile_size - 1)));
+			key_y.push_back(((tile.key & 0xffff) << tile_bits) + (cell >> tile_bits));
+			key_z.push_back(cells_[slot].key_z);
+			costs.push_back(cells_[slot].cost);
+			normals.push_back(cells_[slot].normal);
+		}
+	}
+
+	TerrainSnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+	header.version = snapshot_version;
+	header.num_cells = key_x.size();
+	header.grid_size = map_info_.grid_size;
+	header.height_size = map_info_.height_size;
+	header.plane_origin = map_info_.plane_origin;
+	header.height_origin = map_info_.height_origin;
+	header.max_cost = map_info_.max_cost;
+	header.min_cost = map_info_.min_cost;
+	header.min_key_z = map_info_.min_key_z;
+	strncpy(header.frame_id, map_info_.header.frame_id.c_str(), sizeof(header.frame_id) - 1);
+
+	// Each array starts at the next aligned offset
+	const char* arrays[5] = {NULL, NULL, NULL, NULL, NULL};
+	size_t sizes[5] = {key_x.size() * sizeof(uint16_t), key_y.size() * sizeof(uint16_t),
+					   key_z.size() * sizeof(uint16_t), costs.size() * sizeof(uint16_t),
+					   normals.size() * sizeof(uint32_t)};
+	if (header.num_cells != 0) {
+		arrays[0] = reinterpret_cast<const char*>(&key_x.front());
+		arrays[1] = reinterpret_cast<const char*>(&key_y.front());
+		arrays[2] = reinterpret_cast<const char*>(&key_z.front());
+		arrays[3] = reinterpret_cast<const char*>(&costs.front());
+		arrays[4] = reinterpret_cast<const char*>(&normals.front());
+	}
+	uint64_t offset = sizeof(header);
+	for (unsigned int a = 0; a < 5; a++) {
+		offset = (offset + snapshot_alignment - 1) / snapshot_alignment * snapshot_alignment;
+		header.offsets[a] = offset;
+		offset += sizes[a];
+	}
+
+	std::ofstream file(file_name.c_str(), std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	std::vector<char> padding(snapshot_alignment, 0);
+	offset = sizeof(header);
+	for (unsigned int a = 0; a < 5; a++) {
+		file.write(&padding.front(), header.offsets[a] - offset);
+		if (sizes[a] != 0)
+			file.write(arrays[a], sizes[a]);
+		offset = header.offsets[a] + sizes[a];
+	}
+
+	if (!file) {
+		setStatusStd(StatusProperty::Error, "Snapshot", "Failed to save the file " + file_name);
+		return;
+	}
+	std::stringstream ss;
+	ss << "Saved " << header.num_cells << " cells into " << file_name;
+	setStatusStd(StatusProperty::Ok, "Snapshot", ss.str());
+}
+
+
+void TerrainMapDisplay::loadSnapshot(const std::string& file_name)
+{
+	// Mapping the file, so its arrays are decoded without reading them into
+	// buffers. The file stays mapped until the snapshot is decoded
+	int fd = open(file_name.c_str(), O_RDONLY);
+	struct stat file_stat;
+	void* data = MAP_FAILED;
+	size_t size = 0;
+	if (fd >= 0) {
+		if (fstat(fd, &file_stat) == 0 && (size_t) file_stat.st_size >= sizeof(TerrainSnapshotHeader)) {
+			size = file_stat.st_size;
+			data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		close(fd);
+	}
+	if (data == MAP_FAILED) {
+		setStatusStd(StatusProperty::Error, "Snapshot", "Failed to open the file " + file_name);
+		return;
+	}
+
+	// Checking the format, and that the arrays are aligned and in the file
+	const TerrainSnapshotHeader& snapshot = *reinterpret_cast<const TerrainSnapshotHeader*>(data);
+	const size_t element_sizes[5] = {sizeof(uint16_t), sizeof(uint16_t), sizeof(uint16_t),
+									 sizeof(uint16_t), sizeof(uint32_t)};
+	bool valid = memcmp(snapshot.magic, snapshot_magic, sizeof(snapshot_magic)) == 0 &&
+			snapshot.version == snapshot_version;
+	for (unsigned int a = 0; a < 5 && valid; a++) {
+		valid = snapshot.offsets[a] % snapshot_alignment == 0 && snapshot.offsets[a] <= size &&
+				(uint64_t) snapshot.num_cells * element_sizes[a] <= size - snapshot.offsets[a];
+	}
+	if (!valid) {
+		munmap(data, size);
+		std::stringstream ss;
+		ss << file_name << " isn't a terrain snapshot of version " << snapshot_version;
+		setStatusStd(StatusProperty::Error, "Snapshot", ss.str());
+		return;
+	}
+
+	// The snapshot is queued as a message, so the GUI thread doesn't wait on
+	// its decoding. As any message, a later message supersedes it
+	TerrainMapStream::Ptr msg(new TerrainMapStream());
+	msg->snapshot.reset(&snapshot, SnapshotUnmapper(size));
+	queue_.push(msg, size);
+
+	std::stringstream ss;
+	ss << "Loading " << snapshot.num_cells << " cells from " << file_name;
+	setStatusStd(StatusProperty::Ok, "Snapshot", ss.str());
+}
+
+
+void TerrainMapDisplay::fitRing(const TerrainCellRange& bounds)
+{
+	// The ring of the rolling window has the tiles of the window, so it only
+	// grows when the window grows. The tiles of a window don't share their
+	// place in the ring, and a moved window only takes the tiles that it left
+	unsigned int ring_x = std::max(ring_x_, bounds.max_tile_x - bounds.min_tile_x + 1);
+	unsigned int ring_y = std::max(ring_y_, bounds.max_tile_y - bounds.min_tile_y + 1);
+	if (ring_x == ring_x_ && ring_y == ring_y_)
+		return;
+
+	// The tiles of the previous ring are taken again by the decoded cells, and
+	// the tiles without a key have no cells
+	ring_x_ = ring_x;
+	ring_y_ = ring_y;
+	unsigned int num_tiles = std::max((unsigned int) tile_keys_.size(), ring_x * ring_y);
+	tile_keys_.assign(num_tiles, std::numeric_limits<uint32_t>::max());
+	tile_cells_.assign(num_tiles, 0);
+	tile_stamps_.assign(num_tiles, 0);
+	slots_.assign(num_tiles * tile_cells, TerrainCellSlot());
+	markAllDirty();
+}
+
+
+unsigned int TerrainMapDisplay::takeRingTile(uint32_t tile_key)
+{
+	unsigned int tile_x = tile_key >> 16;
+	unsigned int tile_y = tile_key & 0xffff;
+	unsigned int tile = (tile_y % ring_y_) * ring_x_ + tile_x % ring_x_;
+	if (tile_keys_[tile] != tile_key) {
+		// The previous tile of this place left the window
+		unsigned int first_slot = tile * tile_cells;
+		for (unsigned int slot = first_slot; slot < first_slot + tile_cells; slot++) {
+			if (slots_[slot].used) {
+				slots_[slot].used = false;
+				markDirty(slot);
+			}
+		}
+		tile_keys_[tile] = tile_key;
+		tile_cells_[tile] = 0;
+	}
+
+	return tile;
+}
+
+
+void TerrainMapDisplay::evictTiles(const TerrainCellRange& bounds)
+{
+	unsigned int max_tiles =
+			std::max((uint64_t) 1, (uint64_t) memory_budget_ * 1024 * 1024 / tile_bytes);
+	if (tile_map_.size() <= max_tiles)
+		return;
+
+	// Sorting the tiles that aren't in the message by their age, where the
+	// robot is at the center of the window of the message
+	double robot_x = 0.5 * (bounds.min_tile_x + bounds.max_tile_x);
+	double robot_y = 0.5 * (bounds.min_tile_y + bounds.max_tile_y);
+	std::vector<TileAge> ages;
+	for (TileMap::const_iterator it = tile_map_.begin(); it != tile_map_.end(); it++) {
+		unsigned int tile = it->second;
+		if (tile_stamps_[tile] == slot_stamp_)
+			continue;
+
+		double dx = (double) (tile_keys_[tile] >> 16) - robot_x;
+		double dy = (double) (tile_keys_[tile] & 0xffff) - robot_y;
+		TileAge age = {tile_stamps_[tile], dx * dx + dy * dy, tile};
+		ages.push_back(age);
+	}
+
+	unsigned int num_evicted = std::min(tile_map_.size() - max_tiles, ages.size());
+	std::partial_sort(ages.begin(), ages.begin() + num_evicted, ages.end());
+	for (unsigned int i = 0; i < num_evicted; i++) {
+		unsigned int tile = ages[i].tile;
+		unsigned int first_slot = tile * tile_cells;
+		for (unsigned int slot = first_slot; slot < first_slot + tile_cells; slot++) {
+			if (slots_[slot].used) {
+				slots_[slot].used = false;
+				markDirty(slot);
+			}
+		}
+		tile_cells_[tile] = 0;
+		tile_map_.erase(tile_keys_[tile]);
+		free_tiles_.push_back(tile);
+	}
+	num_evicted_ += num_evicted;
+}
+
+
+void TerrainMapDisplay::markDirty(unsigned int slot)
+{
+	markDirty(slot, dirty_slots_);
+}
+
+
+void TerrainMapDisplay::markDirty(unsigned int slot,
+								  std::vector<unsigned int>& dirty_slots)
+{
+	if (!slots_[slot].dirty) {
+		slots_[slot].dirty = true;
+		dirty_slots.push_back(slot);
+	}
+}
+
+
+void TerrainMapDisplay::markAllDirty()
+{
+	dirty_slots_.resize(slots_.size());
+	for (unsigned int slot = 0; slot < slots_.size(); slot++) {
+		slots_[slot].dirty = true;
+		dirty_slots_[slot] = slot;
+	}
+	full_rewrite_ = true;
+}
+
+
+void TerrainMapDisplay::applyFrame(TerrainMapFrame& frame)
+{
+	// Updating the tiles, where a tile that changed its key, i.e. a free tile
+	// that was taken by a new tile, or that lost all its cells is built again
+	unsigned int num_tiles = frame.tile_keys.size();
+	for (unsigned int t = tiles_.size(); t < num_tiles; t++) {
+		tiles_.push_back(boost::shared_ptr<TerrainTile>(new TerrainTile()));
+		tiles_[t]->index = t;
+		createTile(*tiles_[t]);
+	}
+
+	std::vector<uint32_t> moved_keys;
+	for (unsigned int t = 0; t < num_tiles; t++) {
+		TerrainTile& tile = *tiles_[t];
+		if (tile.key != frame.tile_keys[t] ||
+				(tile.num_cells == 0) != (frame.tile_cells[t] == 0)) {
+			if (tile.num_cells != 0)
+				moved_keys.push_back(tile.key);
+			tile.key = frame.tile_keys[t];
+			tile.redraw_all = true;
+			attachTile(tile);
+		}
+		tile.num_cells = frame.tile_cells[t];
+	}
+	tile_indexes_.clear();
+	for (unsigned int t = 0; t < num_tiles; t++) {
+		if (tiles_[t]->num_cells != 0)
+			tile_indexes_[tiles_[t]->key] = t;
+	}
+
+	// The previous tiles of a moved tile have its first row and column as
+	// surface vertexs
+	for (unsigned int i = 0; i < moved_keys.size(); i++) {
+		int tile_x = moved_keys[i] >> 16;
+		int tile_y = moved_keys[i] & 0xffff;
+		int previous[3] = {getTile(tile_x - 1, tile_y),
+						   getTile(tile_x, tile_y - 1),
+						   getTile(tile_x - 1, tile_y - 1)};
+		for (unsigned int p = 0; p < 3; p++) {
+			if (previous[p] >= 0)
+				tiles_[previous[p]]->retriangulate = true;
+		}
+	}
+
+	// Copying the dirty slots, and marking their cells, voxels and surface
+	// vertexs
+	cells_.resize(num_tiles * tile_cells);
+	used_.resize(num_tiles * tile_cells, 0);
+	for (unsigned int i = 0; i < frame.dirty_slots.size(); i++) {
+		unsigned int slot = frame.dirty_slots[i];
+		bool topology_changed = used_[slot] != frame.used[i];
+		cells_[slot] = frame.cells[i];
+		used_[slot] = frame.used[i];
+
+		unsigned int t = slot / tile_cells;
+		unsigned int cell = slot % tile_cells;
+		TerrainTile& tile = *tiles_[t];
+		tile.redraw_cells.push_back(cell);
+		tile.voxels_changed = true;
+
+		// The cell is a surface vertex of its tile, and of the previous tiles
+		// when it's in their first row or column
+		unsigned int x = cell & (tile_size - 1);
+		unsigned int y = cell >> tile_bits;
+		int tile_x = tile.key >> 16;
+		int tile_y = tile.key & 0xffff;
+		markSurfaceVertex(t, y * surface_size + x, topology_changed);
+		if (x == 0)
+			markSurfaceVertex(getTile(tile_x - 1, tile_y),
+							  y * surface_size + tile_size, topology_changed);
+		if (y == 0)
+			markSurfaceVertex(getTile(tile_x, tile_y - 1),
+							  tile_size * surface_size + x, topology_changed);
+		if (x == 0 && y == 0)
+			markSurfaceVertex(getTile(tile_x - 1, tile_y - 1),
+							  tile_size * surface_size + tile_size, topology_changed);
+	}
+	if (frame.full_rewrite) {
+		for (unsigned int t = 0; t < tiles_.size(); t++) {
+			tiles_[t]->redraw_all = true;
+			tiles_[t]->voxels_changed = true;
+		}
+	}
+	redraw_ = true;
+
+	// The cost range only changes the mapping of the colormap
+	if (map_info_.num_messages == 0 || frame.info.max_cost != map_info_.max_cost ||
+			frame.info.min_cost != map_info_.min_cost) {
+		colormap_.setRange(frame.info.min_cost, frame.info.max_cost);
+		colormap_changed_ = true;
+	}
+	map_info_ = frame.info;
+	transform_pending_ = true;
+
+	setStatus(StatusProperty::Ok, "Messages",
+			QString::number(map_info_.num_messages) + " terrain map messages received");
+	setStatus(StatusProperty::Ok, "Tiles",
+			QString::number(map_info_.num_tiles) + " tiles, " +
+			QString::number(map_info_.num_evicted) + " evicted");
+}
+
+
+void TerrainMapDisplay::updateQueueStatus()
+{
+	size_t queued_bytes;
+	unsigned int num_dropped;
+	queue_.getState(queued_bytes, num_dropped);
+	if (queued_bytes == status_queued_bytes_ && num_dropped == status_dropped_)
+		return;
+
+	std::stringstream ss;
+	ss << queued_bytes / 1024 << " KB queued, " << num_dropped << " messages dropped";
+	setStatusStd(StatusProperty::Ok, "Queue", ss.str());
+	status_queued_bytes_ = queued_bytes;
+	status_dropped_ = num_dropped;
+}
+
+
+void TerrainMapDisplay::createTile(TerrainTile& tile)
+{
+	tile.column_object.reset(scene_manager_->createManualObject());
+	tile.column_object->setDynamic(true);
+
+	tile.surface_object.reset(scene_manager_->createManualObject());
+	tile.surface_object->setDynamic(true);
+
+	tile.normal_object.reset(scene_manager_->createManualObject());
+	tile.normal_object->setDynamic(true);
+
+	tile.cloud.reset(new rviz::PointCloud());
+	tile.cloud->setRenderMode(rviz::PointCloud::RM_BOXES);
+
+	attachTile(tile);
+}
+
+
+void TerrainMapDisplay::attachTile(TerrainTile& tile)
+{
+	// Ogre culls by the boxes of the scene nodes, so each tile has a child
+	// node with its objects, whose bounding boxes only have their cells. A
+	// reused tile takes a new node, so it doesn't keep the box of its
+	// previous cells
+	destroyTileNode(tile);
+	tile.node = scene_node_->createChildSceneNode();
+	tile.node->attachObject(tile.column_object.get());
+	tile.node->attachObject(tile.surface_object.get());
+	tile.node->attachObject(tile.normal_object.get());
+	tile.node->attachObject(tile.cloud.get());
+}
+
+
+void TerrainMapDisplay::destroyTileNode(TerrainTile& tile)
+{
+	if (tile.node == NULL)
+		return;
+
+	tile.node->detachAllObjects();
+	scene_manager_->destroySceneNode(tile.node);
+	tile.node = NULL;
+}
+
+
+int TerrainMapDisplay::getTile(int tile_x,
+							   int tile_y) const
+{
+	if (tile_x < 0 || tile_y < 0)
+		return -1;
+
+	TileMap::const_iterator it = tile_indexes_.find(((uint32_t) tile_x << 16) | tile_y);
+	if (it == tile_indexes_.end())
+		return -1;
+
+	return it->second;
+}
+
+
+void TerrainMapDisplay::markSurfaceVertex(int tile,
+										  unsigned int vertex,
+										  bool topology_changed)
+{
+	if (tile < 0)
+		return;
+
+	tiles_[tile]->redraw_vertexs.push_back(vertex);
+	if (topology_changed)
+		tiles_[tile]->retriangulate = true;
+}
+
+
+void TerrainMapDisplay::updateLevels()
+{
+	// Building again the levels of the changed tiles, once per update
+	std::vector<unsigned int> changed_tiles;
+	if (redraw_) {
+		for (unsigned int t = 0; t < tiles_.size(); t++) {
+			TerrainTile& tile = *tiles_[t];
+			if (tile.num_cells != 0 && (tile.redraw_all || !tile.redraw_cells.empty())) {
+				buildLevels(tile);
+				changed_tiles.push_back(t);
+			}
+		}
+	}
+
+	// A cell of the level 0 is projected as its size times the pixels per
+	// meter at its distance, i.e. height / (2 tan(fovy / 2) distance). The
+	// LOD is disabled when there is no camera
+	Ogre::Camera* camera = NULL;
+	if (context_->getViewManager()->getCurrent())
+		camera = context_->getViewManager()->getCurrent()->getCamera();
+	float pixel_scale = 0.;
+	Ogre::Vector3 camera_position;
+	if (camera && camera->getViewport() && lod_size_property_->getFloat() > 0.) {
+		pixel_scale = camera->getViewport()->getActualHeight() /
+				(2. * tan(0.5 * camera->getFOVy().valueRadians()));
+		camera_position = scene_node_->_getDerivedOrientation().Inverse() *
+				(camera->getDerivedPosition() - scene_node_->_getDerivedPosition());
+	}
+
+	for (unsigned int t = 0; t < tiles_.size(); t++) {
+		TerrainTile& tile = *tiles_[t];
+		unsigned int level = 0;
+		if (pixel_scale > 0. && tile.num_cells != 0)
+			level = selectLevel(tile, camera_position, pixel_scale);
+		if (level != tile.level) {
+			tile.level = level;
+			tile.redraw_all = true;
+			tile.voxels_changed = true;
+			redraw_ = true;
+		}
+	}
+
+	// The last row and column of surface vertexs of a coarse tile are blocks
+	// of the next tiles, so the coarse previous tiles of a changed tile are
+	// built again
+	for (unsigned int i = 0; i < changed_tiles.size(); i++) {
+		const TerrainTile& tile = *tiles_[changed_tiles[i]];
+		int tile_x = tile.key >> 16;
+		int tile_y = tile.key & 0xffff;
+		int previous[3] = {getTile(tile_x - 1, tile_y),
+						   getTile(tile_x, tile_y - 1),
+						   getTile(tile_x - 1, tile_y - 1)};
+		for (unsigned int p = 0; p < 3; p++) {
+			if (previous[p] >= 0 && tiles_[previous[p]]->level != 0)
+				tiles_[previous[p]]->retriangulate = true;
+		}
+	}
+}
+
+
+void TerrainMapDisplay::buildLevels(TerrainTile& tile)
+{
+	// The blocks are placed from the center of the first cell of the tile
+	double grid_size = map_info_.grid_size;
+	unsigned int first_slot = tile.index * tile_cells;
+	Ogre::Vector3 origin(map_info_.plane_origin + ((tile.key >> 16) << tile_bits) * grid_size,
+						 map_info_.plane_origin + ((tile.key & 0xffff) << tile_bits) * grid_size,
+						 0.);
+	tile.box.setNull();
+	for (unsigned int cell = 0; cell < tile_cells; cell++) {
+		bool used;
+		Column column = getTileCell(tile, 0, cell & (tile_size - 1), cell >> tile_bits, used);
+		if (!used)
+			continue;
+
+		tile.box.merge(column.top);
+		tile.box.merge(Ogre::Vector3(column.top.x, column.top.y, column.bottom));
+	}
+
+	// Each level aggregates the 2x2 blocks of the previous level, where the
+	// mean cost and normal are weighted by the number of cells of the blocks
+	tile.level_columns.resize(tile_bits + 1);
+	tile.level_used.resize(tile_bits + 1);
+	std::vector<unsigned int> counts;
+	std::vector<unsigned int> previous_counts(tile_cells);
+	for (unsigned int i = 0; i < tile_cells; i++)
+		previous_counts[i] = used_[first_slot + i];
+	for (unsigned int level = 1; level <= tile_bits; level++) {
+		unsigned int side = tile_size >> level;
+		double block_size = grid_size * (1 << level);
+		double block_offset = 0.5 * ((1 << level) - 1) * grid_size;
+		std::vector<Column>& columns = tile.level_columns[level];
+		std::vector<char>& used = tile.level_used[level];
+		columns.assign(side * side, Column());
+		used.assign(side * side, 0);
+		counts.assign(side * side, 0);
+		for (unsigned int y = 0; y < side; y++) {
+			for (unsigned int x = 0; x < side; x++) {
+				unsigned int cell = y * side + x;
+				Column& column = columns[cell];
+				column.top = Ogre::Vector3(origin.x + x * block_size + block_offset,
+										   origin.y + y * block_size + block_offset, 0.);
+				column.cost = 0.;
+				column.normal = Ogre::Vector3::ZERO;
+				for (unsigned int c = 0; c < 4; c++) {
+					unsigned int child_x = 2 * x + (c & 1);
+					unsigned int child_y = 2 * y + (c >> 1);
+					bool child_used;
+					Column child = getTileCell(tile, level - 1, child_x, child_y, child_used);
+					if (!child_used)
+						continue;
+
+					unsigned int child_count = previous_counts[child_y * 2 * side + child_x];
+					if (counts[cell] == 0 || child.top.z > column.top.z)
+						column.top.z = child.top.z;
+					column.bottom = child.bottom;
+					column.cost += child.cost * child_count;
+					column.normal += child.normal * child_count;
+					counts[cell] += child_count;
+				}
+
+				if (counts[cell] != 0) {
+					column.cost /= counts[cell];
+					used[cell] = 1;
+				}
+			}
+		}
+		previous_counts.swap(counts);
+	}
+}
+
+
+unsigned int TerrainMapDisplay::selectLevel(const TerrainTile& tile,
+											const Ogre::Vector3& camera_position,
+											float pixel_scale) const
+{
+	// Distance from the camera to the nearest point of the tile, where the
+	// tiles that are nearer than a cell have all their cells
+	const Ogre::Vector3& min = tile.box.getMinimum();
+	const Ogre::Vector3& max = tile.box.getMaximum();
+	Ogre::Vector3 nearest(Ogre::Math::Clamp(camera_position.x, min.x, max.x),
+						  Ogre::Math::Clamp(camera_position.y, min.y, max.y),
+						  Ogre::Math::Clamp(camera_position.z, min.z, max.z));
+	float distance = camera_position.distance(nearest);
+	if (distance <= map_info_.grid_size)
+		return 0;
+
+	// The cells of the level l are 2^l times larger, so the drawn primitives
+	// of a tile decrease with the square of its distance. The cells of the
+	// chosen level are projected at least the minimum size
+	float cell_pixels = map_info_.grid_size * pixel_scale / distance;
+	float min_pixels = lod_size_property_->getFloat();
+	unsigned int level = 0;
+	while (level < tile_bits && cell_pixels * (1 << level) < min_pixels)
+		level++;
+
+	return level;
+}
+
+
+Column TerrainMapDisplay::getTileCell(const TerrainTile& tile,
+									  unsigned int level,
+									  unsigned int x,
+									  unsigned int y,
+									  bool& used) const
+{
+	// The column covers the voxels of the cell, from its key down to the
+	// lowest key of the map
+	if (level == 0) {
+		unsigned int slot = tile.index * tile_cells + (y << tile_bits) + x;
+		const CompactCell& cell = cells_[slot];
+		unsigned int key_x = ((tile.key >> 16) << tile_bits) + x;
+		unsigned int key_y = ((tile.key & 0xffff) << tile_bits) + y;
+		Column column;
+		column.top = Ogre::Vector3(map_info_.plane_origin + key_x * map_info_.grid_size,
+								   map_info_.plane_origin + key_y * map_info_.grid_size,
+								   map_info_.height_origin + (cell.key_z + 0.5) * map_info_.height_size);
+		column.bottom = map_info_.height_origin + (map_info_.min_key_z - 0.5) * map_info_.height_size;
+		column.cost = unpackCost(cell.cost);
+		column.normal = unpackNormal(cell.normal);
+		used = used_[slot];
+		return column;
+	}
+
+	unsigned int cell = y * (tile_size >> level) + x;
+	used = tile.level_used[level][cell];
+	return tile.level_columns[level][cell];
+}
+
+
+void TerrainMapDisplay::updateTransform()
+{
+	// Getting tf transform, which is tried again at the next update when the
+	// frame isn't available yet
+	Ogre::Vector3 position;
+	Ogre::Quaternion orientation;
+	if (!context_->getFrameManager()->getTransform(map_info_.header,
+												   position,
+												   orientation)) {
 		std::stringstream ss;
 		ss << "Failed to transform from frame [";
-		ss << terrain_msg_->header.frame_id << "] to frame ["
+		ss << map_info_.header.frame_id << "] to frame ["
 		   << context_->getFrameManager()->getFixedFrame() << "]";
 		this->setStatusStd(StatusProperty::Error, "Message", ss.str());
 
 		return;
 	}
-	scene_node_->setOrientation(orientation_);
-	scene_node_->setPosition(position_);
+	scene_node_->setOrientation(orientation);
+	scene_node_->setPosition(position);
+	deleteStatusStd("Message");
+	transform_pending_ = false;
+}
 
-	// Getting the number of cells
-	unsigned int num_cells = terrain_msg_->cell.size();
 
-	// Computing the maximum and minimum cost of the map, and minimum key
-	// of the height
-	max_cost_ = 0.;
-	min_cost_ = std::numeric_limits<double>::max();
-	min_key_z_ = std::numeric_limits<unsigned int>::max();
-	for (unsigned int i = 0; i < num_cells; i++) {
-		double cost = terrain_msg_->cell[i].cost;
-		if (max_cost_ < cost)
-			max_cost_ = cost;
+void TerrainMapDisplay::drawVoxels(TerrainTile& tile)
+{
+	tile.cloud->clear();
+	tile.voxels.clear();
+	tile.voxel_costs.clear();
+	if (render_mode_ != VOXELS || tile.num_cells == 0)
+		return;
 
-		if (min_cost_ > cost)
-			min_cost_ = cost;
+	// Expanding the voxels of the cells of the level of the tile, from the top
+	// of each column down to its bottom. The voxels of the level l are 2^l
+	// times larger
+	float voxel_size = map_info_.grid_size * (1 << tile.level);
+	float voxel_height = map_info_.height_size * (1 << tile.level);
+	unsigned int side = tile_size >> tile.level;
+	PointCloud::Point new_point;
+	for (unsigned int cell = 0; cell < side * side; cell++) {
+		bool used;
+		Column column = getTileCell(tile, tile.level, cell % side, cell / side, used);
+		if (!used)
+			continue;
+
+		unsigned int num_voxels =
+				std::max(1., ceil((column.top.z - column.bottom) / voxel_height - 1e-3));
+		for (unsigned int v = 0; v < num_voxels; v++) {
+			new_point.position = Ogre::Vector3(column.top.x, column.top.y,
+											   column.top.z - (v + 0.5) * voxel_height);
+			tile.voxels.push_back(new_point);
+			tile.voxel_costs.push_back(column.cost);
+		}
+	}
+	tile.cloud->setDimensions(voxel_size, voxel_size, voxel_height);
+	colorVoxels(tile);
+}
 
-		if (min_key_z_ > terrain_msg_->cell[i].key_z)
-			min_key_z_ = terrain_msg_->cell[i].key_z;
+
+void TerrainMapDisplay::colorVoxels(TerrainTile& tile)
+{
+	tile.cloud->clear();
+	if (tile.voxels.empty())
+		return;
+
+	// Coloring all the voxels of the tile from their costs in a batch
+	colormap_.getColors(&tile.voxels.front().color, sizeof(PointCloud::Point),
+						&tile.voxel_costs.front(), tile.voxel_costs.size());
+	tile.cloud->addPoints(&tile.voxels.front(), tile.voxels.size());
+}
+
+
+void TerrainMapDisplay::createColormaps()
+{
+	// Each color mode has its colormap texture, so changing the color mode
+	// only changes the texture of the materials. The packed colors of the
+	// table are the pixels of the texture
+	static int count = 0;
+	Colormap colormap;
+	std::vector<Ogre::RGBA> pixels;
+	colormap_textures_.resize(PLASMA + 1);
+	for (unsigned int mode = FULL_COLOR; mode <= PLASMA; mode++) {
+		colormap.setType(static_cast<ColormapType>(mode));
+		pixels = colormap.getTable();
+
+		Ogre::DataStreamPtr pixel_stream;
+		pixel_stream.bind(new Ogre::MemoryDataStream(&pixels.front(),
+													 pixels.size() * sizeof(Ogre::RGBA)));
+		std::stringstream ss;
+		ss << "TerrainColormap" << count++;
+		colormap_textures_[mode] =
+				Ogre::TextureManager::getSingleton().loadRawData(ss.str(), "rviz", pixel_stream,
+																 Colormap::size, 1, Ogre::PF_R8G8B8A8,
+																 Ogre::TEX_TYPE_1D, 0);
 	}
-	grid_size_ = terrain_msg_->plane_size;
-	height_size_ = terrain_msg_->height_size;
+}
 
 
-	// Getting terrain values and size of the pixel
-	dwl::environment::SpaceDiscretization space_discretization(grid_size_);
-	space_discretization.setEnvironmentResolution(height_size_, false);
-	PointCloud::Point new_point;
-	normal_buf_.resize(num_cells);
+void TerrainMapDisplay::createColormapUnit(const Ogre::MaterialPtr& material)
+{
+	// The texture color modulates the vertex color, or the lighting
+	Ogre::TextureUnitState* tex_unit =
+			material->getTechnique(0)->getPass(0)->createTextureUnitState();
+	tex_unit->setTextureName(colormap_textures_[colormap_.getType()]->getName(),
+							 Ogre::TEX_TYPE_1D);
+	tex_unit->setTextureAddressingMode(Ogre::TextureUnitState::TAM_CLAMP);
+	tex_unit->setTextureFiltering(Ogre::TFO_NONE);
+}
+
+
+void TerrainMapDisplay::updateColormap()
+{
+	// The texture coordinate is the cost, which is normalized by the texture
+	// transform, i.e. u' = (u - min_cost) / (max_cost - min_cost)
+	double range = map_info_.max_cost - map_info_.min_cost;
+	double scale = range > 0. ? 1. / range : 0.;
+	Ogre::Matrix4 transform = Ogre::Matrix4::IDENTITY;
+	transform[0][0] = scale;
+	transform[0][3] = -map_info_.min_cost * scale;
+
+	Ogre::MaterialPtr materials[2] = {column_material_, surface_material_};
+	for (unsigned int i = 0; i < 2; i++) {
+		Ogre::TextureUnitState* tex_unit =
+				materials[i]->getTechnique(0)->getPass(0)->getTextureUnitState(0);
+		tex_unit->setTextureName(colormap_textures_[colormap_.getType()]->getName(),
+								 Ogre::TEX_TYPE_1D);
+		tex_unit->setTextureTransform(transform);
+	}
+}
+
+
+bool TerrainMapDisplay::hasVertexBuffer(Ogre::ManualObject* object,
+										unsigned int num_vertexs)
+{
+	// The buffers of a tile have a fixed number of vertexs, so they are kept
+	// until the tile is built again
+	if (object->getNumSections() == 0)
+		return false;
+
+	return object->getSection(0)->getRenderOperation()->vertexData->vertexCount == num_vertexs;
+}
+
+
+bool TerrainMapDisplay::getColumnVertexs(const Column& column,
+										 bool used,
+										 float half_size,
+										 Ogre::Vector3* positions,
+										 Ogre::ColourValue* colours,
+										 float& cost)
+{
+	// The column of a free cell collapses to its last top, so its faces have
+	// no area
+	if (!used) {
+		for (unsigned int v = 0; v < 8; v++) {
+			positions[v] = column.top;
+			colours[v] = Ogre::ColourValue::ZERO;
+		}
+		cost = 0.;
+		return false;
+	}
+
+	// The bottom vertexs are darker, so the sides are shaded. The vertex color
+	// modulates the colormap color
+	const float corner_x[4] = {-half_size, half_size, half_size, -half_size};
+	const float corner_y[4] = {-half_size, -half_size, half_size, half_size};
+	Ogre::ColourValue side_color(0.5, 0.5, 0.5);
+	cost = column.cost;
+	for (unsigned int v = 0; v < 4; v++) {
+		positions[v] = Ogre::Vector3(column.top.x + corner_x[v],
+									 column.top.y + corner_y[v],
+									 column.bottom);
+		colours[v] = side_color;
+		positions[v + 4] = Ogre::Vector3(column.top.x + corner_x[v],
+										 column.top.y + corner_y[v],
+										 column.top.z);
+		colours[v + 4] = Ogre::ColourValue::White;
+	}
+	return true;
+}
+
+
+bool TerrainMapDisplay::getSurfaceVertex(const TerrainTile& tile,
+										 unsigned int vertex,
+										 Ogre::Vector3& position,
+										 Ogre::Vector3& normal,
+										 float& cost)
+{
+	// The last row and column of vertexs are the cells of the next tiles, at
+	// the level of the tile
+	unsigned int side = tile_size >> tile.level;
+	unsigned int x = vertex % (side + 1);
+	unsigned int y = vertex / (side + 1);
+	int tile_index = tile.index;
+	if (x == side || y == side)
+		tile_index = getTile((tile.key >> 16) + x / side,
+							 (tile.key & 0xffff) + y / side);
+
+	// The vertexs without cell aren't used by the triangles
+	bool used = false;
+	Column column;
+	if (tile_index >= 0)
+		column = getTileCell(*tiles_[tile_index], tile.level, x % side, y % side, used);
+	if (!used) {
+		position = Ogre::Vector3::ZERO;
+		normal = Ogre::Vector3::UNIT_Z;
+		cost = 0.;
+		return false;
+	}
+
+	position = column.top;
+	normal = column.normal;
+	if (normal.normalise() == 0.)
+		normal = Ogre::Vector3::UNIT_Z;
+	cost = column.cost;
+	return true;
+}
+
+
+bool TerrainMapDisplay::getNormalVertexs(const TerrainTile& tile,
+										 unsigned int cell,
+										 unsigned int stride,
+										 float length,
+										 Ogre::Vector3* positions)
+{
+	bool used;
+	Column column = getTileCell(tile, 0, cell & (tile_size - 1), cell >> tile_bits, used);
+	positions[0] = column.top - Ogre::Vector3(0., 0., 0.5 * map_info_.height_size);
+	if (used && (tile.index * tile_cells + cell) % stride == 0) {
+		positions[1] = positions[0] + length * column.normal;
+		return true;
+	}
+
+	positions[1] = positions[0];
+	return false;
+}
+
+
+void TerrainMapDisplay::drawColumns(TerrainTile& tile)
+{
+	tile.column_object->clear();
+	if (render_mode_ != COLUMNS || tile.num_cells == 0)
+		return;
+
+	// Each cell has 4 bottom and 4 top vertexs, and the top face and 4 side
+	// faces. There is a column for each cell of the level of the tile, so the
+	// cells of the level 0 are rewritten in place. The bounding box only has
+	// the used cells, so the tile is culled by its cells
+	unsigned int side = tile_size >> tile.level;
+	unsigned int num_cells = side * side;
+	float half_size = 0.5 * map_info_.grid_size * (1 << tile.level);
+	Ogre::Vector3 positions[8];
+	Ogre::ColourValue colours[8];
+	float cost;
+	Ogre::AxisAlignedBox box;
+	tile.column_object->estimateVertexCount(8 * num_cells);
+	tile.column_object->estimateIndexCount(30 * num_cells);
+	tile.column_object->begin(column_material_->getName(), Ogre::RenderOperation::OT_TRIANGLE_LIST);
 	for (unsigned int i = 0; i < num_cells; i++) {
-		// Getting the Cartesian information of the terrain map
-		double x, y, z;
-		space_discretization.keyToCoord(x, terrain_msg_->cell[i].key_x, true);
-		space_discretization.keyToCoord(y, terrain_msg_->cell[i].key_y, true);
-		space_discretization.keyToCoord(z, terrain_msg_->cell[i].key_z, false);
-		Ogre::Vector3 cell_position(x, y, z);
-
-		unsigned int key_z = terrain_msg_->cell[i].key_z;
-		while (key_z >= min_key_z_) {
-			space_discretization.keyToCoord(z, key_z, false);
-			Ogre::Vector3 cell_position(x, y, z);
-			new_point.position = cell_position;
-
-			// Setting the color of the cell according the cost value
-			setColor(terrain_msg_->cell[i].cost,
-					 max_cost_, min_cost_,
-					 color_factor_, new_point);
-			key_z -= 1;
-
-			point_buf_.push_back(new_point);
+		bool used;
+		Column column = getTileCell(tile, tile.level, i % side, i / side, used);
+		used = getColumnVertexs(column, used, half_size, positions, colours, cost);
+		for (unsigned int v = 0; v < 8; v++) {
+			tile.column_object->position(positions[v]);
+			tile.column_object->colour(colours[v]);
+			tile.column_object->textureCoord(cost);
+			if (used)
+				box.merge(positions[v]);
 		}
 
+		// Top face
+		unsigned int first = 8 * i;
+		tile.column_object->quad(first + 4, first + 5, first + 6, first + 7);
 
-		// Defining the surface normal orientation
-		if (normal_enable_property_->getBool()) {
-			Eigen::Vector3d ref_dir = -Eigen::Vector3d::UnitZ();
-			Eigen::Quaterniond normal_q;
-			Eigen::Vector3d normal(msg->cell[i].normal.x,
-								   msg->cell[i].normal.y,
-								   msg->cell[i].normal.z);
-			normal_q.setFromTwoVectors(ref_dir, normal);
-			Ogre::Quaternion normal_orientation(normal_q.w(), normal_q.x(),
-												normal_q.y(), normal_q.z());
-
-			Normal new_normal;
-			new_normal.setNormal(cell_position, normal_orientation);
-			normal_buf_[i] = new_normal;
+		// Side faces, which have counter-clockwise vertexs seen from outside
+		for (unsigned int v = 0; v < 4; v++) {
+			unsigned int a = first + v;
+			unsigned int b = first + (v + 1) % 4;
+			tile.column_object->quad(a, b, b + 4, a + 4);
+		}
+	}
+	tile.column_object->end();
+	tile.column_object->setBoundingBox(box);
+}
+
+
+void TerrainMapDisplay::writeColumns(TerrainTile& tile)
+{
+	std::vector<ColumnVertex> vertexs(8 * tile.redraw_cells.size());
+	Ogre::AxisAlignedBox box = tile.column_object->getBoundingBox();
+	float half_size = 0.5 * map_info_.grid_size;
+	Ogre::Vector3 positions[8];
+	Ogre::ColourValue colours[8];
+	float cost;
+	for (unsigned int i = 0; i < tile.redraw_cells.size(); i++) {
+		unsigned int cell = tile.redraw_cells[i];
+		bool used;
+		Column column = getTileCell(tile, 0, cell & (tile_size - 1), cell >> tile_bits, used);
+		used = getColumnVertexs(column, used, half_size, positions, colours, cost);
+		for (unsigned int v = 0; v < 8; v++) {
+			vertexs[8 * i + v].set(positions[v], colours[v], cost);
+			if (used)
+				box.merge(positions[v]);
 		}
 	}
+	writeSlotVertexs(tile.column_object.get(), tile.redraw_cells, vertexs, 8);
+	tile.column_object->setBoundingBox(box);
+}
+
+
+void TerrainMapDisplay::drawSurface(TerrainTile& tile)
+{
+	tile.surface_object->clear();
+	if (render_mode_ != SURFACE || tile.num_cells == 0)
+		return;
+
+	// Adding a vertex per cell of the tile and of the first row and column of
+	// the next tiles, so the vertexs of the level 0 are rewritten in place.
+	// The triangles only change when cells are added or removed
+	unsigned int side = tile_size >> tile.level;
+	unsigned int vertex_side = side + 1;
+	unsigned int num_vertexs = vertex_side * vertex_side;
+	std::vector<char> valid(num_vertexs);
+	Ogre::Vector3 position, normal;
+	float cost;
+	Ogre::AxisAlignedBox box;
+	tile.surface_object->estimateVertexCount(num_vertexs);
+	tile.surface_object->estimateIndexCount(6 * side * side);
+	tile.surface_object->begin(surface_material_->getName(),
+							   Ogre::RenderOperation::OT_TRIANGLE_LIST);
+	for (unsigned int v = 0; v < num_vertexs; v++) {
+		valid[v] = getSurfaceVertex(tile, v, position, normal, cost);
+		tile.surface_object->position(position);
+		tile.surface_object->normal(normal);
+		tile.surface_object->textureCoord(cost);
+		if (valid[v])
+			box.merge(position);
+	}
+
+	// Adding the triangles of each square of the grid, which has one triangle
+	// when one of its cells is missing. The vertexs are counter-clockwise seen
+	// from above
+	for (unsigned int y = 0; y < side; y++) {
+		for (unsigned int x = 0; x < side; x++) {
+			unsigned int square[4] = {y * vertex_side + x,
+									  y * vertex_side + x + 1,
+									  (y + 1) * vertex_side + x + 1,
+									  (y + 1) * vertex_side + x};
+			unsigned int vertexs[4];
+			unsigned int num_square_vertexs = 0;
+			for (unsigned int v = 0; v < 4; v++) {
+				if (valid[square[v]])
+					vertexs[num_square_vertexs++] = square[v];
+			}
+
+			if (num_square_vertexs == 4)
+				tile.surface_object->quad(vertexs[0], vertexs[1], vertexs[2], vertexs[3]);
+			else if (num_square_vertexs == 3)
+				tile.surface_object->triangle(vertexs[0], vertexs[1], vertexs[2]);
+		}
+	}
+	tile.surface_object->end();
+	tile.surface_object->setBoundingBox(box);
+}
+
+
+void TerrainMapDisplay::writeSurface(TerrainTile& tile)
+{
+	// A vertex can be marked by several cells of the same frame
+	std::vector<unsigned int>& redraw_vertexs = tile.redraw_vertexs;
+	std::sort(redraw_vertexs.begin(), redraw_vertexs.end());
+	redraw_vertexs.erase(std::unique(redraw_vertexs.begin(), redraw_vertexs.end()),
+						 redraw_vertexs.end());
+
+	std::vector<SurfaceVertex> vertexs(redraw_vertexs.size());
+	Ogre::AxisAlignedBox box = tile.surface_object->getBoundingBox();
+	Ogre::Vector3 position, normal;
+	float cost;
+	for (unsigned int i = 0; i < redraw_vertexs.size(); i++) {
+		if (getSurfaceVertex(tile, redraw_vertexs[i], position, normal, cost))
+			box.merge(position);
+		vertexs[i].set(position, normal, cost);
+	}
+	writeSlotVertexs(tile.surface_object.get(), redraw_vertexs, vertexs, 1);
+	tile.surface_object->setBoundingBox(box);
+}
+
+
+void TerrainMapDisplay::drawNormals(TerrainTile& tile)
+{
+	// The surface mode is shaded by the normals, so it doesn't draw them. The
+	// normals of the coarse levels would be smaller than a pixel
+	tile.normal_object->clear();
+	if (!normal_enable_property_->getBool() || render_mode_ == SURFACE ||
+			tile.num_cells == 0 || tile.level != 0)
+		return;
+
+	// Adding a line per cell of the tile, so the lines are rewritten in place
+	unsigned int stride = normal_stride_property_->getInt();
+	float length = normal_length_property_->getFloat();
+	Ogre::Vector3 positions[2];
+	Ogre::AxisAlignedBox box;
+	tile.normal_object->estimateVertexCount(2 * tile_cells);
+	tile.normal_object->begin(normal_material_->getName(), Ogre::RenderOperation::OT_LINE_LIST);
+	for (unsigned int cell = 0; cell < tile_cells; cell++) {
+		if (getNormalVertexs(tile, cell, stride, length, positions)) {
+			box.merge(positions[0]);
+			box.merge(positions[1]);
+		}
+		tile.normal_object->position(positions[0]);
+		tile.normal_object->position(positions[1]);
+	}
+	tile.normal_object->end();
+	tile.normal_object->setBoundingBox(box);
+}
 
-	// Recording the data from the buffers
-	new_points_.swap(point_buf_);
-
-	new_points_received_ = true;
-}
-
-
-void TerrainMapDisplay::setColor(double cost_value,
-								 double max_cost,
-								 double min_cost,
-								 double factor,
-								 rviz::PointCloud::Point& point)
-{
-	VoxelColorMode color_mode =
-			static_cast<VoxelColorMode>(voxel_color_property_->getOptionInt());
-
-	switch (color_mode)
-	{
-	case FULL_COLOR:
-	{
-		// This a color map method proposed by Paul Bourke. For further details
-		// please read: http://paulbourke.net/texture_colour/colourspace/
-		double r = 1., g = 1., b = 1.;
-		if (cost_value < min_cost)
-			cost_value = min_cost;
-		if (cost_value > max_cost)
-			cost_value = max_cost;
-		double dv = max_cost - min_cost;
-
-		if (cost_value < (min_cost + 0.25 * dv)) {
-			r = 0.;
-			g = 4 * (cost_value - min_cost) / dv;
-		} else if (cost_value < (min_cost + 0.5 * dv)) {
-			r = 0.;
-			b = 1 + 4 * (min_cost + 0.25 * dv - cost_value) / dv;
-		} else if (cost_value < (min_cost + 0.75 * dv)) {
-			r = 4 * (cost_value - min_cost - 0.5 * dv) / dv;
-			b = 0.;
-		} else {
-			g = 1 + 4 * (min_cost + 0.75 * dv - cost_value) / dv;
-			b = 0.;
+
+void TerrainMapDisplay::writeNormals(TerrainTile& tile)
+{
+	std::vector<LineVertex> vertexs(2 * tile.redraw_cells.size());
+	Ogre::AxisAlignedBox box = tile.normal_object->getBoundingBox();
+	unsigned int stride = normal_stride_property_->getInt();
+	float length = normal_length_property_->getFloat();
+	Ogre::Vector3 positions[2];
+	for (unsigned int i = 0; i < tile.redraw_cells.size(); i++) {
+		bool used = getNormalVertexs(tile, tile.redraw_cells[i], stride, length, positions);
+		for (unsigned int v = 0; v < 2; v++) {
+			vertexs[2 * i + v].set(positions[v]);
+			if (used)
+				box.merge(positions[v]);
 		}
-		point.setColor(r, g, b);
-		break;
-	} case GREY:
-	{
-		double v = (cost_value - max_cost) / (min_cost - max_cost);
-		point.setColor(v, v, v);
-		break;
-	} default:
-		break;
 	}
+	writeSlotVertexs(tile.normal_object.get(), tile.redraw_cells, vertexs, 2);
+	tile.normal_object->setBoundingBox(box);
 }
 
 
 void TerrainMapDisplay::clear()
 {
-	boost::mutex::scoped_lock lock(mutex_);
+	// The callback thread drops the decoded state of the previous generation,
+	// so clearing doesn't wait on the decoding
+	generation_++;
+	boost::atomic_store(&frame_, boost::shared_ptr<TerrainMapFrame>());
 
-	cloud_->clear();
-	normal_buf_.clear();
+	destroyObjects();
 }
 
 
@@ -412,6 +2038,12 @@ void TerrainMapDisplay::updateQueueSize()
 }
 
 
+void TerrainMapDisplay::updateQueueBudget()
+{
+	queue_.setBudget((size_t) queue_budget_property_->getInt() << 20);
+}
+
+
 void TerrainMapDisplay::updateTopic()
 {
 	unsubscribe();
@@ -421,58 +2053,77 @@ void TerrainMapDisplay::updateTopic()
 }
 
 
-void TerrainMapDisplay::updateColorMode()
+void TerrainMapDisplay::updateRenderMode()
 {
-	if (messages_received_ != 0) {
-		boost::mutex::scoped_lock lock(mutex_);
-
-		// Clearing the voxel buffers
-		point_buf_.clear();
-		new_points_.clear();
-
-		// Getting the number of cells
-		unsigned int num_cells = terrain_msg_->cell.size();
-
-		// Getting terrain values and size of the pixel
-		dwl::environment::SpaceDiscretization space_discretization(grid_size_);
-		space_discretization.setEnvironmentResolution(height_size_, false);
-		PointCloud::Point new_point;
-		for (unsigned int i = 0; i < num_cells; i++) {
-			// Getting the Cartesian information of the terrain map
-			double x, y, z;
-			space_discretization.keyToCoord(x, terrain_msg_->cell[i].key_x, true);
-			space_discretization.keyToCoord(y, terrain_msg_->cell[i].key_y, true);
-			space_discretization.keyToCoord(z, terrain_msg_->cell[i].key_z, false);
-			Ogre::Vector3 cell_position(x, y, z);
-
-			unsigned int key_z = terrain_msg_->cell[i].key_z;
-			while (key_z >= min_key_z_) {
-				space_discretization.keyToCoord(z, key_z, false);
-				Ogre::Vector3 cell_position(x, y, z);
-				new_point.position = cell_position;
-
-				// Setting the color of the cell according the cost value
-				setColor(terrain_msg_->cell[i].cost,
-						 max_cost_, min_cost_,
-						 color_factor_, new_point);
-				key_z -= 1;
-
-				point_buf_.push_back(new_point);
-			}
-		}
+	// The meshes and voxels are built again from the cells of the render
+	// thread
+	render_mode_ = static_cast<TerrainRenderMode>(render_mode_property_->getOptionInt());
+	for (unsigned int t = 0; t < tiles_.size(); t++) {
+		tiles_[t]->voxels_changed = true;
+		tiles_[t]->redraw_all = true;
+	}
+	redraw_ = true;
 
-		// Recording the data from the buffers
-		new_points_.swap(point_buf_);
+	context_->queueRender();
+}
 
-		// Drawing the terrain cost values
-		if (new_points_.size() != 0) {
-			cloud_->clear();
-			cloud_->setDimensions(grid_size_, grid_size_, height_size_);
-			cloud_->addPoints(&new_points_.front(), new_points_.size());
-		}
 
-		context_->queueRender();
+void TerrainMapDisplay::updateLevelOfDetail()
+{
+	// The levels are chosen again at the next update
+	context_->queueRender();
+}
+
+
+void TerrainMapDisplay::updateRollingWindow()
+{
+	// The tiles are addressed differently, so the decoded state is dropped
+	// and the map is decoded again from the next message
+	rolling_window_ = rolling_window_property_->getBool();
+	clear();
+	context_->queueRender();
+}
+
+
+void TerrainMapDisplay::updateAccumulate()
+{
+	// The accumulated map starts from the next message
+	accumulate_ = accumulate_property_->getBool();
+	queue_.setLatestWins(!accumulate_);
+	clear();
+	context_->queueRender();
+}
+
+
+void TerrainMapDisplay::updateMemoryBudget()
+{
+	// The budget is applied by the next message
+	memory_budget_ = memory_budget_property_->getInt();
+}
+
+
+void TerrainMapDisplay::updateSnapshot()
+{
+	// The properties are reset, so they act as buttons
+	std::string file_name = snapshot_file_property_->getStdString();
+	if (save_snapshot_property_->getBool()) {
+		save_snapshot_property_->setValue(false);
+		saveSnapshot(file_name);
 	}
+	if (load_snapshot_property_->getBool()) {
+		load_snapshot_property_->setValue(false);
+		loadSnapshot(file_name);
+	}
+}
+
+
+void TerrainMapDisplay::updateColorMode()
+{
+	// Swapping the colormap, so only the voxels are colored again
+	colormap_.setType(static_cast<ColormapType>(voxel_color_property_->getOptionInt()));
+	colormap_changed_ = true;
+
+	context_->queueRender();
 }
 
 
@@ -482,37 +2133,42 @@ void TerrainMapDisplay::updateNormalStatus()
 		normal_category_->show();
 		normal_color_property_->show();
 		normal_alpha_property_->show();
-		normal_head_length_property_->show();
-		normal_head_radius_property_->show();
-		normal_shaft_length_property_->show();
-		normal_shaft_radius_property_->show();
+		normal_length_property_->show();
+		normal_stride_property_->show();
 	} else {
 		normal_category_->hide();
 		normal_color_property_->hide();
 		normal_alpha_property_->hide();
-		normal_head_length_property_->hide();
-		normal_head_radius_property_->hide();
-		normal_shaft_length_property_->hide();
-		normal_shaft_radius_property_->hide();
+		normal_length_property_->hide();
+		normal_stride_property_->hide();
 	}
+
+	updateNormalLines();
 }
 
 
 void TerrainMapDisplay::updateNormalArrowGeometry()
 {
+	if (normal_material_.isNull())
+		return;
+
+	// The normal lines of all the tiles share this material, so a color or
+	// alpha change recolors them without rewriting their vertex buffers. The
+	// line list is written without normals, hence the emissive color
 	Ogre::ColourValue color = normal_color_property_->getOgreColor();
-	color.a = normal_alpha_property_->getFloat();
-	float shaft_length = normal_shaft_length_property_->getFloat();
-	float shaft_radius = normal_shaft_radius_property_->getFloat();
-	float head_length = normal_head_length_property_->getFloat();
-	float head_radius = normal_head_radius_property_->getFloat();
+	normal_material_->setAmbient(0., 0., 0.);
+	normal_material_->setDiffuse(0., 0., 0., normal_alpha_property_->getFloat());
+	normal_material_->setSelfIllumination(color.r, color.g, color.b);
+
+	context_->queueRender();
+}
 
-	for (unsigned int j = 0; j < arrow_cloud_.size(); j++) {
-		arrow_cloud_[j]->setColor(color.r, color.g, color.b, color.a);
-		arrow_cloud_[j]->setProperties(shaft_length, shaft_radius,
-									   head_length, head_radius);
-	}
 
+void TerrainMapDisplay::updateNormalLines()
+{
+	// The length and stride rewrite the lines
+	for (unsigned int t = 0; t < tiles_.size(); t++)
+		drawNormals(*tiles_[t]);
 	context_->queueRender();
 }
 
@@ -7,6 +7,10 @@
 #include <OgreManualObject.h>
 #include <OgreBillboardSet.h>
 #include <OgreMatrix4.h>
+#include <OgreMaterialManager.h>
+#include <OgreRoot.h>
+#include <OgreRenderSystem.h>
+#include <OgreHardwareVertexBuffer.h>
 
 #include <tf/transform_listener.h>
 
@@ -17,22 +21,88 @@
 #include <rviz/properties/float_property.h>
 #include <rviz/properties/int_property.h>
 #include <rviz/properties/vector_property.h>
+#include <rviz/properties/string_property.h>
+#include <rviz/properties/ros_topic_property.h>
 #include <rviz/validate_floats.h>
 
 #include <rviz/ogre_helpers/billboard_line.h>
 #include <rviz/ogre_helpers/axes.h>
 
+#include <sstream>
+#include <iomanip>
+
 
 using namespace rviz;
 
 namespace dwl_rviz_plugin
 {
 
-WholeBodyTrajectoryDisplay::WholeBodyTrajectoryDisplay() : is_info_(false)
+/** @brief Vertex of the line strips of the episode, as it's laid out by
+ * Ogre::ManualObject for a position and a colour */
+struct LineStripVertex
+{
+	void set(const Ogre::Vector3& p, const Ogre::ColourValue& c) {
+		x = p.x; y = p.y; z = p.z;
+		Ogre::Root::getSingleton().getRenderSystem()->convertColourValue(c, &colour);
+	}
+
+	float x, y, z;
+	Ogre::uint32 colour;
+};
+
+
+/**
+ * @brief Appends the new points of a line strip into its vertex buffer, which
+ * has room for them. Only the new vertexs are written, and the drawn vertex
+ * count and the bounds grow
+ * @param Ogre::ManualObject* Line strip
+ * @param const std::vector<Ogre::Vector3>& Points of the line strip
+ * @param uint32_t First new point
+ * @param const Ogre::ColourValue& Color of the line strip
+ */
+static void appendLineStrip(Ogre::ManualObject* object,
+							const std::vector<Ogre::Vector3>& points,
+							uint32_t first,
+							const Ogre::ColourValue& color)
 {
+	Ogre::VertexData* vertex_data = object->getSection(0)->getRenderOperation()->vertexData;
+	Ogre::HardwareVertexBufferSharedPtr buffer = vertex_data->vertexBufferBinding->getBuffer(0);
+	std::vector<LineStripVertex> vertexs(points.size() - first);
+	Ogre::AxisAlignedBox box = object->getBoundingBox();
+	for (uint32_t i = first; i < points.size(); i++) {
+		vertexs[i - first].set(points[i], color);
+		box.merge(points[i]);
+	}
+
+	buffer->writeData(first * sizeof(LineStripVertex),
+					  vertexs.size() * sizeof(LineStripVertex),
+					  &vertexs.front());
+	vertex_data->vertexCount = points.size();
+	object->setBoundingBox(box);
+}
+
+
+WholeBodyTrajectoryDisplay::WholeBodyTrajectoryDisplay() : is_info_(false),
+		history_head_(0), history_size_(0), history_max_samples_(1000),
+		append_time_(0.), append_base_capacity_(0), pick_index_dirty_(false)
+{
+	// Update mode properties
+	update_mode_property_ =
+			new EnumProperty("Update Mode", "Replace",
+							 "Replace draws only the last trajectory. The append modes "
+							 "add each received chunk to the trajectory of the current "
+							 "planning episode, which starts when the header stamp "
+							 "changes or when the time of the chunk goes backward.",
+							 this, SLOT(updateAppendMode()), this);
+	update_mode_property_->addOption("Replace", REPLACE);
+	update_mode_property_->addOption("Append by Stamp", APPEND_STAMP);
+	update_mode_property_->addOption("Append by Time", APPEND_TIME);
+
 	// Category Groups
 	base_category_ = new rviz::Property("Base", QVariant(), "", this);
 	contact_category_ = new rviz::Property("End-Effector", QVariant(), "", this);
+	history_category_ = new rviz::Property("History", QVariant(), "", this);
+	pick_category_ = new rviz::Property("Inspection", QVariant(), "", this);
 
 	// Base trajectory properties
 	base_style_property_ =
@@ -101,36 +171,170 @@ WholeBodyTrajectoryDisplay::WholeBodyTrajectoryDisplay() : is_info_(false)
 							  contact_category_, SLOT(updateContactLineProperties()), this);
 	contact_alpha_property_->setMin(0);
 	contact_alpha_property_->setMax(1);
+
+
+	// History properties
+	history_depth_property_ =
+			new IntProperty("Depth", 0,
+							"Number of previous trajectories shown as fading ghosts. "
+							"0 disables the history.",
+							history_category_, SLOT(updateHistoryDepth()), this);
+	history_depth_property_->setMin(0);
+	history_depth_property_->setMax(50);
+
+	history_max_samples_property_ =
+			new IntProperty("Max Samples", history_max_samples_,
+							"Maximum number of vertices per ghost trajectory. Longer "
+							"trajectories are decimated to fit.",
+							history_category_, SLOT(updateHistoryDepth()), this);
+	history_max_samples_property_->setMin(2);
+
+	history_color_property_ =
+			new ColorProperty("Color", QColor(150, 150, 150),
+							  "Color to draw the previous trajectories.",
+							  history_category_, SLOT(updateHistoryColorAndAlpha()), this);
+
+	history_alpha_property_ =
+			new FloatProperty("Alpha", 0.5,
+							  "Alpha of the most recent ghost, older ghosts fade linearly.",
+							  history_category_, SLOT(updateHistoryColorAndAlpha()), this);
+	history_alpha_property_->setMin(0);
+	history_alpha_property_->setMax(1);
+
+
+	// Inspection properties
+	pick_topic_property_ =
+			new RosTopicProperty("Pick Topic", "/clicked_point",
+								 QString::fromStdString(ros::message_traits::datatype<geometry_msgs::PointStamped>()),
+								 "Clicked points to inspect, e.g. from the Publish Point tool.",
+								 pick_category_, SLOT(updatePickTopic()), this);
+
+	pick_radius_property_ =
+			new FloatProperty("Pick Radius", 0.1,
+							  "Maximum distance, in meters, from the clicked point to a sample.",
+							  pick_category_);
+	pick_radius_property_->setMin(0);
+
+	pick_time_property_ =
+			new FloatProperty("Time", 0.,
+							  "Time of the picked sample.",
+							  pick_category_);
+	pick_time_property_->setReadOnly(true);
+
+	pick_base_position_property_ =
+			new VectorProperty("Base Position", Ogre::Vector3::ZERO,
+							   "Base position of the picked sample.",
+							   pick_category_);
+	pick_base_position_property_->setReadOnly(true);
+
+	pick_base_rpy_property_ =
+			new VectorProperty("Base RPY", Ogre::Vector3::ZERO,
+							   "Base orientation, in RPY angles, of the picked sample.",
+							   pick_category_);
+	pick_base_rpy_property_->setReadOnly(true);
+
+	pick_contacts_property_ =
+			new StringProperty("Contacts", "",
+							   "Contact state and force norm of each end-effector of the "
+							   "picked sample.",
+							   pick_category_);
+	pick_contacts_property_->setReadOnly(true);
 }
 
 
 WholeBodyTrajectoryDisplay::~WholeBodyTrajectoryDisplay()
 {
+	pick_sub_.shutdown();
 	destroyObjects();
+	destroyHistory();
 }
 
 
 void WholeBodyTrajectoryDisplay::onInitialize()
 {
 	MFDClass::onInitialize();
+	updateHistoryDepth();
+}
+
+
+void WholeBodyTrajectoryDisplay::onEnable()
+{
+	MFDClass::onEnable();
+	updatePickTopic();
+}
+
+
+void WholeBodyTrajectoryDisplay::onDisable()
+{
+	MFDClass::onDisable();
+	pick_sub_.shutdown();
 }
 
 
 void WholeBodyTrajectoryDisplay::fixedFrameChanged()
 {
-	if (is_info_) {
+	// The ghosts were computed in the old fixed frame
+	updateHistoryDepth();
+
+	if (!append_msgs_.empty()) {
+		rebuildAppendedTrajectory();
+	} else if (is_info_) {
 		// Visualization of the base trajectory
 		processBaseTrajectory();
 
 		// Visualization of the end-effector trajectory
 		processContactTrajectory();
 	}
+
+	// The samples were indexed in the old fixed frame
+	pick_index_dirty_ = true;
 }
 
 
 void WholeBodyTrajectoryDisplay::reset()
 {
 	MFDClass::reset();
+	updateHistoryDepth();
+}
+
+
+void WholeBodyTrajectoryDisplay::updateAppendMode()
+{
+	// Starting a new episode from the last received trajectory
+	destroyObjects();
+	if (is_info_) {
+		UpdateMode mode = (UpdateMode) update_mode_property_->getOptionInt();
+		if (mode == REPLACE) {
+			processBaseTrajectory();
+			processContactTrajectory();
+		} else {
+			append_stamp_ = msg_->header.stamp;
+			appendTrajectory(msg_);
+		}
+	}
+
+	context_->queueRender();
+}
+
+
+void WholeBodyTrajectoryDisplay::updatePickTopic()
+{
+	pick_sub_.shutdown();
+
+	// The clicked points are processed in the GUI thread, where the
+	// properties can be updated
+	const std::string& topic = pick_topic_property_->getStdString();
+	if (topic.empty() || !isEnabled())
+		return;
+
+	try {
+		pick_sub_ = update_nh_.subscribe(topic, 1,
+				&WholeBodyTrajectoryDisplay::processPick, this);
+		setStatus(StatusProperty::Ok, "Pick Topic", "OK");
+	} catch (ros::Exception& e) {
+		setStatus(StatusProperty::Error, "Pick Topic",
+				(std::string("Error subscribing: ") + e.what()).c_str());
+	}
 }
 
 
@@ -296,8 +500,482 @@ void WholeBodyTrajectoryDisplay::updateContactLineProperties()
 }
 
 
+void WholeBodyTrajectoryDisplay::updateHistoryDepth()
+{
+	// Allocating the ring of ghost trajectories. This is the only place where
+	// the history allocates, i.e. once every slot is filled new horizons are
+	// written in place
+	destroyHistory();
+
+	unsigned int depth = history_depth_property_->getInt();
+	history_max_samples_ = history_max_samples_property_->getInt();
+	if (depth == 0 || scene_node_ == NULL)
+		return;
+
+	static int count = 0;
+	history_objects_.resize(depth);
+	history_materials_.resize(depth);
+	for (unsigned int i = 0; i < depth; i++) {
+		// Each slot has its own material, so fading a ghost doesn't require to
+		// rewrite its vertices
+		std::stringstream ss;
+		ss << "WholeBodyTrajectoryHistory" << count++;
+		Ogre::MaterialPtr material =
+				Ogre::MaterialManager::getSingleton().create(ss.str(), "rviz");
+		material->setReceiveShadows(false);
+		material->setSceneBlending(Ogre::SBT_TRANSPARENT_ALPHA);
+		material->setDepthWriteEnabled(false);
+		history_materials_[i] = material;
+
+		history_objects_[i].reset(scene_manager_->createManualObject());
+		history_objects_[i]->setDynamic(true);
+		history_objects_[i]->estimateVertexCount(history_max_samples_);
+		history_objects_[i]->setVisible(false);
+		scene_node_->attachObject(history_objects_[i].get());
+	}
+
+	updateHistoryColorAndAlpha();
+}
+
+
+void WholeBodyTrajectoryDisplay::updateHistoryColorAndAlpha()
+{
+	Ogre::ColourValue color = history_color_property_->getOgreColor();
+	float alpha = history_alpha_property_->getFloat();
+	unsigned int depth = history_objects_.size();
+	for (unsigned int i = 0; i < history_size_; i++) {
+		// Slot of the i-th most recent ghost
+		unsigned int slot = (history_head_ + depth - 1 - i) % depth;
+		float ghost_alpha = alpha * (float) (depth - i) / (float) depth;
+
+		// The lines have no normals, so the color comes from the self
+		// illumination and the alpha from the diffuse term
+		history_materials_[slot]->setAmbient(0., 0., 0.);
+		history_materials_[slot]->setDiffuse(0., 0., 0., ghost_alpha);
+		history_materials_[slot]->setSelfIllumination(color.r, color.g, color.b);
+	}
+
+	if (context_ != NULL)
+		context_->queueRender();
+}
+
+
+void WholeBodyTrajectoryDisplay::pushHistory(const dwl_msgs::WholeBodyTrajectory::ConstPtr& msg)
+{
+	if (history_objects_.empty() || msg->trajectory.empty())
+		return;
+
+	// Lookup transform into fixed frame
+	Ogre::Vector3 position;
+	Ogre::Quaternion orientation;
+	if (!context_->getFrameManager()->getTransform(msg->header, position, orientation)) {
+		ROS_DEBUG("Error transforming from frame '%s' to frame '%s'",
+				  msg->header.frame_id.c_str(), qPrintable(fixed_frame_));
+	}
+	Ogre::Matrix4 transform(orientation);
+	transform.setTrans(position);
+
+	// Decimating the trajectory so that it fits in the slot. Each base and
+	// end-effector sample adds at most one segment, i.e. two vertices
+	uint32_t num_points = msg->trajectory.size();
+	uint32_t num_samples = num_points;
+	for (uint32_t i = 0; i < num_points; i++)
+		num_samples += msg->trajectory[i].contacts.size();
+	uint32_t stride =
+			(2 * num_samples + history_max_samples_ - 1) / history_max_samples_;
+	if (stride == 0)
+		stride = 1;
+
+	// Writing the line list of the trajectory in the oldest slot
+	boost::shared_ptr<Ogre::ManualObject> object = history_objects_[history_head_];
+	if (object->getNumSections() == 0)
+		object->begin(history_materials_[history_head_]->getName(),
+					  Ogre::RenderOperation::OT_LINE_LIST);
+	else
+		object->beginUpdate(0);
+
+	unsigned int num_vertices = 0;
+	unsigned int num_contacts = 0;
+	bool has_base = false;
+	Ogre::Vector3 last_base_pos = Ogre::Vector3::ZERO;
+	for (uint32_t i = 0; i < num_points; i += stride) {
+		const dwl_msgs::WholeBodyState& state = msg->trajectory[i];
+
+		// Computing the actual base position
+		Ogre::Vector3 base_pos;
+		Eigen::Vector3d base_rpy;
+		getBasePose(base_pos, base_rpy, state);
+		if (!(std::isfinite(base_pos.x) && std::isfinite(base_pos.y) &&
+				std::isfinite(base_pos.z) && base_rpy.allFinite()))
+			continue;
+
+		Ogre::Vector3 xpos = transform * base_pos;
+		if (has_base && num_vertices + 2 <= history_max_samples_) {
+			object->position(last_base_pos);
+			object->position(xpos);
+			num_vertices += 2;
+		}
+		last_base_pos = xpos;
+		has_base = true;
+
+		// Computing the base to world transform
+		Eigen::Quaterniond quat = dwl::math::getQuaternion(base_rpy);
+		Ogre::Quaternion ogre_quat(quat.w(), quat.x(), quat.y(), quat.z());
+		Ogre::Matrix4 base_to_world_tf(ogre_quat);
+
+		// Adding a segment from the last point of each end-effector
+		for (uint32_t k = 0; k < state.contacts.size(); k++) {
+			const dwl_msgs::ContactState& contact = state.contacts[k];
+			Ogre::Vector3 contact_pos = transform * (base_pos +
+					base_to_world_tf * Ogre::Vector3(contact.position.x,
+													 contact.position.y,
+													 contact.position.z));
+			if (!(std::isfinite(contact_pos.x) && std::isfinite(contact_pos.y) &&
+					std::isfinite(contact_pos.z)))
+				continue;
+
+			unsigned int id = 0;
+			while (id < num_contacts && history_contacts_[id].first != contact.name)
+				id++;
+			if (id == num_contacts) {
+				// A new end-effector, the entries are reused across horizons
+				if (num_contacts == history_contacts_.size())
+					history_contacts_.push_back(std::make_pair(contact.name, contact_pos));
+				else
+					history_contacts_[id].first = contact.name;
+				num_contacts++;
+			} else if (num_vertices + 2 <= history_max_samples_) {
+				object->position(history_contacts_[id].second);
+				object->position(contact_pos);
+				num_vertices += 2;
+			}
+			history_contacts_[id].second = contact_pos;
+		}
+	}
+
+	// Ogre drops sections without vertices, so we keep a degenerated segment
+	if (num_vertices == 0) {
+		object->position(last_base_pos);
+		object->position(last_base_pos);
+	}
+	object->end();
+	object->setVisible(true);
+
+	// Moving the head of the ring and fading the older ghosts
+	history_head_ = (history_head_ + 1) % history_objects_.size();
+	if (history_size_ < history_objects_.size())
+		history_size_++;
+	updateHistoryColorAndAlpha();
+}
+
+
+void WholeBodyTrajectoryDisplay::destroyHistory()
+{
+	history_objects_.clear();
+	for (unsigned int i = 0; i < history_materials_.size(); i++)
+		Ogre::MaterialManager::getSingleton().remove(history_materials_[i]->getName());
+	history_materials_.clear();
+	history_head_ = 0;
+	history_size_ = 0;
+}
+
+
+bool WholeBodyTrajectoryDisplay::isNewEpisode(const dwl_msgs::WholeBodyTrajectory::ConstPtr& msg)
+{
+	if (append_msgs_.empty())
+		return true;
+
+	UpdateMode mode = (UpdateMode) update_mode_property_->getOptionInt();
+	if (mode == APPEND_STAMP)
+		return msg->header.stamp != append_stamp_;
+	else
+		return !msg->trajectory.empty() &&
+				msg->trajectory.front().time < append_time_;
+}
+
+
+void WholeBodyTrajectoryDisplay::appendTrajectory(const dwl_msgs::WholeBodyTrajectory::ConstPtr& msg)
+{
+	append_msgs_.push_back(msg);
+	if (msg->trajectory.empty())
+		return;
+	append_time_ = msg->trajectory.back().time;
+
+	// Lookup transform into fixed frame
+	Ogre::Vector3 position;
+	Ogre::Quaternion orientation;
+	if (!context_->getFrameManager()->getTransform(msg->header, position, orientation)) {
+		ROS_DEBUG("Error transforming from frame '%s' to frame '%s'",
+				  msg->header.frame_id.c_str(), qPrintable(fixed_frame_));
+	}
+	Ogre::Matrix4 transform(orientation);
+	transform.setTrans(position);
+
+	// Only the new chunk is decoded, the points of the previous chunks are
+	// kept in the episode buffers
+	uint32_t first_base = append_base_pos_.size();
+	std::vector<uint32_t> first_contact(append_contact_pos_.size());
+	for (uint32_t k = 0; k < append_contact_pos_.size(); k++)
+		first_contact[k] = append_contact_pos_[k].size();
+
+	uint32_t num_points = msg->trajectory.size();
+	for (uint32_t i = 0; i < num_points; i++) {
+		const dwl_msgs::WholeBodyState& state = msg->trajectory[i];
+
+		// Computing the actual base position
+		Ogre::Vector3 base_pos;
+		Eigen::Vector3d base_rpy;
+		getBasePose(base_pos, base_rpy, state);
+		if (!(std::isfinite(base_pos.x) && std::isfinite(base_pos.y) &&
+				std::isfinite(base_pos.z) && base_rpy.allFinite()))
+			continue;
+
+		Eigen::Quaterniond quat = dwl::math::getQuaternion(base_rpy);
+		Ogre::Quaternion ogre_quat(quat.w(), quat.x(), quat.y(), quat.z());
+		append_base_pos_.push_back(transform * base_pos);
+		append_base_orientation_.push_back(ogre_quat * orientation);
+
+		// Adding the end-effector points to their trajectories
+		Ogre::Matrix4 base_to_world_tf(ogre_quat);
+		for (uint32_t k = 0; k < state.contacts.size(); k++) {
+			const dwl_msgs::ContactState& contact = state.contacts[k];
+			Ogre::Vector3 xpos = transform * (base_pos +
+					base_to_world_tf * Ogre::Vector3(contact.position.x,
+													 contact.position.y,
+													 contact.position.z));
+			if (!(std::isfinite(xpos.x) && std::isfinite(xpos.y) && std::isfinite(xpos.z)))
+				continue;
+
+			std::map<std::string, uint32_t>::iterator it =
+					append_contact_id_.find(contact.name);
+			uint32_t traj_id;
+			if (it == append_contact_id_.end()) {// a new swing trajectory
+				traj_id = append_contact_pos_.size();
+				append_contact_id_[contact.name] = traj_id;
+				append_contact_pos_.push_back(std::vector<Ogre::Vector3>());
+				append_contact_capacity_.push_back(0);
+				first_contact.push_back(0);
+			} else
+				traj_id = it->second;
+
+			append_contact_pos_[traj_id].push_back(xpos);
+		}
+	}
+
+	// Drawing the new points
+	drawAppendedBase(first_base);
+	drawAppendedContacts(first_contact);
+}
+
+
+void WholeBodyTrajectoryDisplay::rebuildAppendedTrajectory()
+{
+	std::vector<dwl_msgs::WholeBodyTrajectory::ConstPtr> msgs;
+	msgs.swap(append_msgs_);
+
+	destroyObjects();
+	for (uint32_t i = 0; i < msgs.size(); i++)
+		appendTrajectory(msgs[i]);
+}
+
+
+void WholeBodyTrajectoryDisplay::drawAppendedBase(uint32_t first)
+{
+	uint32_t num_points = append_base_pos_.size();
+	LineStyle base_style = (LineStyle) base_style_property_->getOptionInt();
+	Ogre::ColourValue base_color = base_color_property_->getOgreColor();
+	base_color.a = base_alpha_property_->getFloat();
+	float base_line_width = base_line_width_property_->getFloat();
+	if (first == 0) {
+		base_manual_object_.reset();
+		base_billboard_line_.reset();
+		base_points_.clear();
+		base_axes_.clear();
+		append_base_capacity_ = 0;
+	}
+
+	switch (base_style)
+	{
+	case LINES: {
+		// The vertex buffer is only reallocated when the episode outgrows it,
+		// otherwise only the new points are written at the end of the buffer
+		if (num_points > append_base_capacity_) {
+			append_base_capacity_ = std::max(num_points, 2 * append_base_capacity_);
+			base_manual_object_.reset(scene_manager_->createManualObject());
+			base_manual_object_->setDynamic(true);
+			scene_node_->attachObject(base_manual_object_.get());
+			base_manual_object_->estimateVertexCount(append_base_capacity_);
+			base_manual_object_->begin("BaseWhiteNoLighting",
+									   Ogre::RenderOperation::OT_LINE_STRIP);
+			for (uint32_t i = 0; i < num_points; i++) {
+				base_manual_object_->position(append_base_pos_[i]);
+				base_manual_object_->colour(base_color);
+			}
+			base_manual_object_->end();
+		} else if (num_points > first)
+			appendLineStrip(base_manual_object_.get(), append_base_pos_, first, base_color);
+		break;
+	}
+
+	case BILLBOARDS: {
+		// The billboard line is recreated only when it runs out of points
+		if (num_points > append_base_capacity_) {
+			append_base_capacity_ = std::max(num_points, 2 * append_base_capacity_);
+			base_billboard_line_.reset(new rviz::BillboardLine(scene_manager_, scene_node_));
+			base_billboard_line_->setNumLines(1);
+			base_billboard_line_->setMaxPointsPerLine(append_base_capacity_);
+			base_billboard_line_->setLineWidth(base_line_width);
+			for (uint32_t i = 0; i < first; i++)
+				base_billboard_line_->addPoint(append_base_pos_[i], base_color);
+		}
+
+		for (uint32_t i = first; i < num_points; i++)
+			base_billboard_line_->addPoint(append_base_pos_[i], base_color);
+		break;
+	}
+
+	case POINTS: {
+		for (uint32_t i = first; i < num_points; i++) {
+			boost::shared_ptr<PointVisual> point_visual;
+			point_visual.reset(new PointVisual(context_->getSceneManager(), scene_node_));
+			point_visual->setColor(base_color.r, base_color.g, base_color.b, base_color.a);
+			point_visual->setRadius(base_line_width);
+			point_visual->setPoint(append_base_pos_[i]);
+			base_points_.push_back(point_visual);
+		}
+		break;
+	}
+	}
+
+	// Adding the frames of the new points with a distant from the last one
+	float scale = base_scale_property_->getFloat();
+	for (uint32_t i = first; i < num_points; i++) {
+		Ogre::Vector3 xpos = append_base_pos_[i];
+		if (i != 0 &&
+				xpos.squaredDistance(last_point_position_) < scale * scale * 0.0032)
+			continue;
+
+		boost::shared_ptr<rviz::Axes> axes;
+		axes.reset(new Axes(scene_manager_, scene_node_, 0.04, 0.008));
+		axes->setPosition(xpos);
+		axes->setOrientation(append_base_orientation_[i]);
+		Ogre::ColourValue x_color = axes->getDefaultXColor();
+		Ogre::ColourValue y_color = axes->getDefaultYColor();
+		Ogre::ColourValue z_color = axes->getDefaultZColor();
+		x_color.a = base_alpha_property_->getFloat();
+		y_color.a = base_alpha_property_->getFloat();
+		z_color.a = base_alpha_property_->getFloat();
+		axes->setXColor(x_color);
+		axes->setYColor(y_color);
+		axes->setZColor(z_color);
+		axes->getSceneNode()->setVisible(true);
+		axes->setScale(Ogre::Vector3(scale, scale, scale));
+		base_axes_.push_back(axes);
+
+		last_point_position_ = xpos;
+	}
+}
+
+
+void WholeBodyTrajectoryDisplay::drawAppendedContacts(const std::vector<uint32_t>& first)
+{
+	uint32_t num_traj = append_contact_pos_.size();
+	LineStyle contact_style = (LineStyle) contact_style_property_->getOptionInt();
+	Ogre::ColourValue contact_color = contact_color_property_->getOgreColor();
+	contact_color.a = contact_alpha_property_->getFloat();
+	float contact_line_width = contact_line_width_property_->getFloat();
+
+	contact_manual_object_.resize(num_traj);
+	contact_billboard_line_.resize(num_traj);
+	contact_points_.resize(num_traj);
+	for (uint32_t k = 0; k < num_traj; k++) {
+		const std::vector<Ogre::Vector3>& points = append_contact_pos_[k];
+		uint32_t num_points = points.size();
+		if (first[k] == 0) {
+			contact_manual_object_[k].reset();
+			contact_billboard_line_[k].reset();
+			contact_points_[k].clear();
+			append_contact_capacity_[k] = 0;
+		}
+
+		switch (contact_style)
+		{
+		case LINES: {
+			if (num_points > append_contact_capacity_[k]) {
+				append_contact_capacity_[k] =
+						std::max(num_points, 2 * append_contact_capacity_[k]);
+				contact_manual_object_[k].reset(scene_manager_->createManualObject());
+				contact_manual_object_[k]->setDynamic(true);
+				scene_node_->attachObject(contact_manual_object_[k].get());
+				contact_manual_object_[k]->estimateVertexCount(append_contact_capacity_[k]);
+				contact_manual_object_[k]->begin("BaseWhiteNoLighting",
+												 Ogre::RenderOperation::OT_LINE_STRIP);
+				for (uint32_t i = 0; i < num_points; i++) {
+					contact_manual_object_[k]->position(points[i]);
+					contact_manual_object_[k]->colour(contact_color);
+				}
+				contact_manual_object_[k]->end();
+			} else if (num_points > first[k])
+				appendLineStrip(contact_manual_object_[k].get(), points, first[k], contact_color);
+			break;
+		}
+
+		case BILLBOARDS: {
+			uint32_t first_point = first[k];
+			if (num_points > append_contact_capacity_[k]) {
+				append_contact_capacity_[k] =
+						std::max(num_points, 2 * append_contact_capacity_[k]);
+				contact_billboard_line_[k].reset(new rviz::BillboardLine(scene_manager_, scene_node_));
+				contact_billboard_line_[k]->setNumLines(1);
+				contact_billboard_line_[k]->setMaxPointsPerLine(append_contact_capacity_[k]);
+				contact_billboard_line_[k]->setLineWidth(contact_line_width);
+				first_point = 0;
+			}
+
+			for (uint32_t i = first_point; i < num_points; i++)
+				contact_billboard_line_[k]->addPoint(points[i], contact_color);
+			break;
+		}
+
+		case POINTS: {
+			for (uint32_t i = first[k]; i < num_points; i++) {
+				boost::shared_ptr<PointVisual> point_visual;
+				point_visual.reset(new PointVisual(context_->getSceneManager(), scene_node_));
+				point_visual->setColor(contact_color.r, contact_color.g,
+									   contact_color.b, contact_color.a);
+				point_visual->setRadius(contact_line_width);
+				point_visual->setPoint(points[i]);
+				contact_points_[k].push_back(point_visual);
+			}
+			break;
+		}
+		}
+	}
+}
+
+
 void WholeBodyTrajectoryDisplay::processMessage(const dwl_msgs::WholeBodyTrajectory::ConstPtr& msg)
 {
+	// Appending the chunk to the current planning episode. A new episode
+	// clears the previous one
+	UpdateMode mode = (UpdateMode) update_mode_property_->getOptionInt();
+	if (mode != REPLACE) {
+		if (isNewEpisode(msg)) {
+			destroyObjects();
+			append_stamp_ = msg->header.stamp;
+		}
+
+		msg_ = msg;
+		is_info_ = true;
+		appendTrajectory(msg);
+		pick_index_dirty_ = true;
+		return;
+	}
+
+	// Moving the previous trajectory to the history
+	if (is_info_)
+		pushHistory(msg_);
+
 	// Updating the message
 	msg_ = msg;
 	is_info_ = true;
@@ -310,11 +988,167 @@ void WholeBodyTrajectoryDisplay::processMessage(const dwl_msgs::WholeBodyTraject
 
 	// Visualization of the end-effector trajectory
 	processContactTrajectory();
+
+	// The samples are indexed for the inspection by the next pick
+	pick_index_dirty_ = true;
+}
+
+
+void WholeBodyTrajectoryDisplay::getBasePose(Ogre::Vector3& position,
+											 Eigen::Vector3d& rpy,
+											 const dwl_msgs::WholeBodyState& state)
+{
+	position = Ogre::Vector3::ZERO;
+	rpy.setZero();
+	for (uint32_t j = 0; j < state.base.size(); j++) {
+		const dwl_msgs::BaseState& base = state.base[j];
+		if (base.id == dwl::rbd::LX)
+			position.x = base.position;
+		else if (base.id == dwl::rbd::LY)
+			position.y = base.position;
+		else if (base.id == dwl::rbd::LZ)
+			position.z = base.position;
+		else if (base.id == dwl::rbd::AX)
+			rpy(0) = base.position;
+		else if (base.id == dwl::rbd::AY)
+			rpy(1) = base.position;
+		else
+			rpy(2) = base.position;
+	}
+}
+
+
+void WholeBodyTrajectoryDisplay::buildPickIndex()
+{
+	// Getting the displayed trajectories
+	if (!append_msgs_.empty())
+		pick_msgs_ = append_msgs_;
+	else if (is_info_)
+		pick_msgs_.assign(1, msg_);
+	else
+		pick_msgs_.clear();
+
+	// Collecting the base and end-effector samples in the fixed frame
+	std::vector<Eigen::Vector3f> points;
+	pick_samples_.clear();
+	for (unsigned int m = 0; m < pick_msgs_.size(); m++) {
+		const dwl_msgs::WholeBodyTrajectory& msg = *pick_msgs_[m];
+
+		Ogre::Vector3 position;
+		Ogre::Quaternion orientation;
+		if (!context_->getFrameManager()->getTransform(msg.header, position, orientation)) {
+			ROS_DEBUG("Error transforming from frame '%s' to frame '%s'",
+					  msg.header.frame_id.c_str(), qPrintable(fixed_frame_));
+			continue;
+		}
+		Ogre::Matrix4 transform(orientation);
+		transform.setTrans(position);
+
+		for (unsigned int i = 0; i < msg.trajectory.size(); i++) {
+			const dwl_msgs::WholeBodyState& state = msg.trajectory[i];
+			Ogre::Vector3 base_pos;
+			Eigen::Vector3d base_rpy;
+			getBasePose(base_pos, base_rpy, state);
+
+			Ogre::Vector3 xpos = transform * base_pos;
+			if (std::isfinite(xpos.x) && std::isfinite(xpos.y) && std::isfinite(xpos.z)) {
+				points.push_back(Eigen::Vector3f(xpos.x, xpos.y, xpos.z));
+				pick_samples_.push_back(TrajectorySample(m, i, -1));
+			}
+
+			Eigen::Quaterniond quat = dwl::math::getQuaternion(base_rpy);
+			Ogre::Matrix4 base_to_world_tf(Ogre::Quaternion(quat.w(), quat.x(),
+															quat.y(), quat.z()));
+			for (unsigned int k = 0; k < state.contacts.size(); k++) {
+				const dwl_msgs::ContactState& contact = state.contacts[k];
+				Ogre::Vector3 contact_pos = transform * (base_pos +
+						base_to_world_tf * Ogre::Vector3(contact.position.x,
+														 contact.position.y,
+														 contact.position.z));
+				if (std::isfinite(contact_pos.x) && std::isfinite(contact_pos.y) &&
+						std::isfinite(contact_pos.z)) {
+					points.push_back(Eigen::Vector3f(contact_pos.x,
+													 contact_pos.y,
+													 contact_pos.z));
+					pick_samples_.push_back(TrajectorySample(m, i, k));
+				}
+			}
+		}
+	}
+
+	pick_index_.build(points);
+	pick_index_dirty_ = false;
+}
+
+
+void WholeBodyTrajectoryDisplay::processPick(const geometry_msgs::PointStamped::ConstPtr& msg)
+{
+	// Getting the clicked point in the fixed frame
+	Ogre::Vector3 position;
+	Ogre::Quaternion orientation;
+	if (!context_->getFrameManager()->getTransform(msg->header, position, orientation)) {
+		ROS_DEBUG("Error transforming from frame '%s' to frame '%s'",
+				  msg->header.frame_id.c_str(), qPrintable(fixed_frame_));
+		return;
+	}
+	Ogre::Vector3 point = orientation * Ogre::Vector3(msg->point.x,
+													  msg->point.y,
+													  msg->point.z) + position;
+
+	// Finding the nearest sample, where the index is built again when the
+	// displayed trajectories changed
+	if (pick_index_dirty_)
+		buildPickIndex();
+	unsigned int id;
+	float sq_distance;
+	float radius = pick_radius_property_->getFloat();
+	if (!pick_index_.nearest(id, sq_distance, Eigen::Vector3f(point.x, point.y, point.z)) ||
+			sq_distance > radius * radius) {
+		setStatus(StatusProperty::Warn, "Pick", "No trajectory sample near the clicked point");
+		return;
+	}
+	deleteStatus("Pick");
+
+	// Showing the picked state
+	const TrajectorySample& sample = pick_samples_[id];
+	const dwl_msgs::WholeBodyState& state =
+			pick_msgs_[sample.msg]->trajectory[sample.state];
+	Ogre::Vector3 base_pos;
+	Eigen::Vector3d base_rpy;
+	getBasePose(base_pos, base_rpy, state);
+	pick_time_property_->setValue(state.time);
+	pick_base_position_property_->setVector(base_pos);
+	pick_base_rpy_property_->setVector(Ogre::Vector3(base_rpy(0), base_rpy(1), base_rpy(2)));
+
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(1);
+	for (unsigned int k = 0; k < state.contacts.size(); k++) {
+		const dwl_msgs::ContactState& contact = state.contacts[k];
+		Eigen::Vector3d force(contact.wrench.force.x,
+							  contact.wrench.force.y,
+							  contact.wrench.force.z);
+		if (k != 0)
+			ss << ", ";
+		if ((int) k == sample.contact)
+			ss << "*";
+		ss << contact.name;
+		if (force.norm() > 0.)
+			ss << " (stance, " << force.norm() << " N)";
+		else
+			ss << " (swing)";
+	}
+	pick_contacts_property_->setValue(QString::fromStdString(ss.str()));
 }
 
 
 void WholeBodyTrajectoryDisplay::processBaseTrajectory()
 {
+	// Redrawing the whole episode in the append modes
+	if (!append_msgs_.empty()) {
+		drawAppendedBase(0);
+		return;
+	}
+
 	// Lookup transform into fixed frame
 	Ogre::Vector3 position;
 	Ogre::Quaternion orientation;
@@ -693,6 +1527,12 @@ void WholeBodyTrajectoryDisplay::processBaseTrajectory()
 
 void WholeBodyTrajectoryDisplay::processContactTrajectory()
 {
+	// Redrawing the whole episode in the append modes
+	if (!append_msgs_.empty()) {
+		drawAppendedContacts(std::vector<uint32_t>(append_contact_pos_.size(), 0));
+		return;
+	}
+
 	// Lookup transform into fixed frame
 	Ogre::Vector3 position;
 	Ogre::Quaternion orientation;
@@ -1023,6 +1863,17 @@ void WholeBodyTrajectoryDisplay::destroyObjects()
 	for (uint32_t i = 0; i < contact_points_.size(); i++)
 		contact_points_[i].clear();
 	contact_points_.clear();
+
+	// Clearing the episode of the append modes
+	append_msgs_.clear();
+	append_time_ = 0.;
+	append_base_pos_.clear();
+	append_base_orientation_.clear();
+	append_contact_id_.clear();
+	append_contact_pos_.clear();
+	append_base_capacity_ = 0;
+	append_contact_capacity_.clear();
+	pick_index_dirty_ = true;
 }
 
 } // namespace dwl_rviz_plugin